@@ -0,0 +1,84 @@
+#pragma once
+#include "rv/decode.hpp"
+#include "rv/isa.hpp"
+#include "rv/memory.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rv {
+
+// Runs K copies of one program in lockstep, e.g. for fault-injection
+// campaigns that differ only in their inputs. Each lane has its own RAM and
+// registers; registers are kept structure-of-arrays (regs[r][lane]) so that
+// lanes sitting at the same PC execute an ALU op or branch as one SIMD
+// kernel (AVX2 when the host has it, SSE2 otherwise).
+//
+// Every step picks the lowest PC among running lanes and executes it for
+// the lanes that are there; lanes elsewhere wait, which lets diverged paths
+// reconverge at loop heads and joins. A lane that has waited longer than
+// peel_after steps, or that reaches an instruction the batch path does not
+// handle (CSR access), is peeled off and finished on a scalar CPU.
+//
+// All lanes must run the same, unmodified code: instructions are fetched
+// from the first active lane's memory and cached by PC.
+class BatchEngine {
+public:
+    enum class LaneState : uint8_t { Running, Ebreak, Ecall, Fault };
+
+    BatchEngine(std::size_t lanes, std::size_t mem_size, const Isa& isa = {});
+
+    std::size_t lanes() const { return lanes_; }
+    Memory& memory(std::size_t lane) { return *mems_[lane]; }
+
+    // Copy an image into every lane's RAM.
+    void load_image(const void* data, std::size_t size, uint32_t base);
+
+    void reset(uint32_t pc);
+
+    uint32_t reg(std::size_t lane, int r) const { return regs_[r * stride_ + lane]; }
+    void set_reg(std::size_t lane, int r, uint32_t value) { if (r != 0) regs_[r * stride_ + lane] = value; }
+    uint32_t pc(std::size_t lane) const { return pcs_[lane]; }
+    LaneState state(std::size_t lane) const { return states_[lane]; }
+    const std::string& fault(std::size_t lane) const { return faults_[lane]; }
+    uint64_t instret(std::size_t lane) const { return instret_[lane]; }
+
+    void set_peel_after(uint32_t steps) { peel_after_ = steps; }
+
+    // Run until every lane has stopped or retired max_instructions.
+    void run(uint64_t max_instructions);
+
+    // Counters for the last run().
+    uint64_t lockstep_steps() const { return steps_; }
+    uint64_t peeled_lanes() const { return peeled_; }
+
+    // Name of the SIMD kernel set in use ("avx2", "sse2" or "scalar").
+    const char* kernel_name() const;
+
+private:
+    std::size_t lanes_;
+    std::size_t stride_;                   // lanes rounded up to a multiple of 8
+    Isa isa_;
+
+    std::vector<std::unique_ptr<Memory>> mems_;
+    std::vector<uint32_t> regs_;           // [32][stride_]
+    std::vector<uint32_t> pcs_;            // [stride_]
+    std::vector<uint32_t> mask_;           // [stride_], 0 or ~0
+    std::vector<uint32_t> waited_;         // steps spent waiting on other lanes
+    std::vector<uint64_t> instret_;
+    std::vector<LaneState> states_;
+    std::vector<std::string> faults_;
+
+    std::vector<DecodedInst> dcache_;
+    uint32_t peel_after_ = 256;
+    uint64_t limit_ = 0;                   // max_instructions of the current run()
+    uint64_t steps_ = 0;
+    uint64_t peeled_ = 0;
+
+    const DecodedInst& fetch(uint32_t pc, std::size_t lane);
+    void execute(const DecodedInst& d, uint32_t pc);
+    void peel(std::size_t lane, uint64_t budget);
+};
+
+} // namespace rv
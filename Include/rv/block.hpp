@@ -0,0 +1,80 @@
+#pragma once
+#include "rv/device.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace rv {
+
+class InputLog;
+class Memory;
+
+// Disk backed by a host file, which is mmap'd rather than read up front,
+// so the image can be far larger than guest RAM.
+//
+// The guest reaches the data two ways:
+//   - the sector window at kWindow shows the bytes of sector SECTOR
+//     directly from the mapping, for small reads and writes;
+//   - a DMA descriptor (SECTOR, DMA_ADDR, DMA_COUNT) moves whole sectors
+//     between the mapping and guest RAM when CMD is written. The transfer
+//     is one memcpy per RAM page, finished before the store returns, and
+//     STATUS tells whether it worked.
+//
+// Like any DMA, writing over code does not touch the CPU's decode cache;
+// the guest must execute FENCE.I before running it.
+//
+// With an input log on the memory (rv/replay.hpp), DMA reads and command
+// results are recorded. On replay they come from the log and the image is
+// neither read nor written.
+class BlockDevice : public Device {
+public:
+    static constexpr uint32_t kBase = 0x10001000u;
+    static constexpr uint32_t kSize = 0x1000u;
+    static constexpr uint32_t kSectorSize = 512;
+
+    static constexpr uint32_t kRegCapacity = 0x00; // sectors (read-only)
+    static constexpr uint32_t kRegSector   = 0x04;
+    static constexpr uint32_t kRegDmaAddr  = 0x08;
+    static constexpr uint32_t kRegDmaCount = 0x0C; // sectors
+    static constexpr uint32_t kRegCmd      = 0x10; // write-only
+    static constexpr uint32_t kRegStatus   = 0x14; // result of the last command
+    static constexpr uint32_t kWindow      = 0x200; // kSectorSize bytes
+
+    static constexpr uint32_t kCmdRead  = 1; // disk -> RAM
+    static constexpr uint32_t kCmdWrite = 2; // RAM -> disk
+    static constexpr uint32_t kCmdFlush = 3; // write dirty pages back to the file
+
+    static constexpr uint32_t kStatusOk    = 0;
+    static constexpr uint32_t kStatusError = 1; // bad range, read-only disk or unknown command
+
+    // A trailing partial sector of the file is not visible to the guest.
+    BlockDevice(Memory& mem, const std::string& path, bool read_only = false);
+    ~BlockDevice() override;
+
+    BlockDevice(const BlockDevice&) = delete;
+    BlockDevice& operator=(const BlockDevice&) = delete;
+
+    uint32_t read(uint32_t offset, int size) override;
+    void write(uint32_t offset, uint32_t value, int size) override;
+
+    uint64_t sectors() const { return size_ / kSectorSize; }
+    bool read_only() const { return read_only_; }
+
+private:
+    Memory& mem_;
+    int fd_ = -1;
+    uint8_t* map_ = nullptr;
+    std::size_t size_ = 0;
+    bool read_only_;
+
+    uint32_t sector_ = 0;
+    uint32_t dma_addr_ = 0;
+    uint32_t dma_count_ = 0;
+    uint32_t status_ = kStatusOk;
+
+    uint32_t execute(uint32_t cmd);
+    uint32_t replay_command(InputLog& log);
+    uint8_t* window_byte(uint32_t offset) const;
+};
+
+} // namespace rv
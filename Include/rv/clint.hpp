@@ -0,0 +1,48 @@
+#pragma once
+#include "rv/device.hpp"
+#include <cstdint>
+
+namespace rv {
+
+class CPU;
+
+// SiFive-compatible core-local interruptor for one hart: msip drives the
+// machine software interrupt, mtime/mtimecmp the machine timer interrupt.
+//
+// mtime advances by one per retired instruction. Rather than comparing
+// mtime against mtimecmp every step, a write to mtimecmp (or mtime)
+// schedules a CPU event for the instret at which they meet.
+class Clint : public Device {
+public:
+    static constexpr uint32_t kBase = 0x02000000u;
+    static constexpr uint32_t kSize = 0x10000u;
+
+    static constexpr uint32_t kRegMsip     = 0x0000;
+    static constexpr uint32_t kRegMtimecmp = 0x4000; // low word; high at +4
+    static constexpr uint32_t kRegMtime    = 0xBFF8; // low word; high at +4
+
+    explicit Clint(CPU& cpu);
+
+    uint32_t read(uint32_t offset, int size) override;
+    void write(uint32_t offset, uint32_t value, int size) override;
+    bool deterministic_reads() const override { return true; } // mtime follows instret
+
+    uint64_t mtime() const;
+    uint64_t mtimecmp() const { return mtimecmp_; }
+
+    // Back to power-on state. CPU::reset() drops scheduled events, so call
+    // this after it.
+    void reset();
+
+private:
+    CPU& cpu_;
+    uint64_t mtimecmp_ = ~uint64_t{0};
+    uint64_t offset_ = 0;      // mtime - instret
+    uint64_t generation_ = 0;  // events scheduled for an older mtimecmp are ignored
+    bool msip_ = false;
+
+    void set_mtime(uint64_t value);
+    void update_timer();
+};
+
+} // namespace rv
@@ -0,0 +1,197 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rv {
+
+class CPU;
+
+// One retired instruction. rd is 0 when nothing was written back, in which
+// case value is 0 too. This is also the on-disk record format of a commit
+// log (little-endian hosts), after an 8-byte kCommitLogMagic header.
+struct CommitRecord {
+    uint32_t pc;
+    uint32_t inst;
+    uint32_t rd;
+    uint32_t value;
+
+    bool operator==(const CommitRecord&) const = default;
+};
+static_assert(sizeof(CommitRecord) == 16, "commit log record layout");
+
+inline constexpr char kCommitLogMagic[8] = {'R', 'V', 'C', 'L', 'O', 'G', '0', '1'};
+
+// Receives every retired instruction from CPU::set_commit_sink().
+class CommitSink {
+public:
+    virtual ~CommitSink() = default;
+    virtual void commit(const CommitRecord& r) = 0;
+};
+
+// Produces the golden side of a comparison.
+class CommitSource {
+public:
+    virtual ~CommitSource() = default;
+    // false once the trace has ended
+    virtual bool next(CommitRecord& r) = 0;
+
+    // Up to n records; fewer only at the end of the trace.
+    virtual std::size_t read(CommitRecord* out, std::size_t n) {
+        std::size_t i = 0;
+        while (i < n && next(out[i])) i++;
+        return i;
+    }
+};
+
+// Appends records to a commit log file, or to stdout for "-".
+class CommitLogWriter : public CommitSink {
+public:
+    explicit CommitLogWriter(const std::string& path);
+    ~CommitLogWriter() override;
+
+    void commit(const CommitRecord& r) override {
+        buf_.push_back(r);
+        if (buf_.size() == kBufferRecords) flush();
+    }
+    void flush();
+
+private:
+    static constexpr std::size_t kBufferRecords = 64 * 1024;
+    std::FILE* f_ = nullptr;
+    bool owns_ = false;
+    std::vector<CommitRecord> buf_;
+};
+
+// Reads a commit log. Regular files are mmap'd; pipes, FIFOs and "-"
+// (stdin) are read in chunks as they arrive.
+class CommitLogReader : public CommitSource {
+public:
+    explicit CommitLogReader(const std::string& path);
+    ~CommitLogReader() override;
+
+    CommitLogReader(const CommitLogReader&) = delete;
+    CommitLogReader& operator=(const CommitLogReader&) = delete;
+
+    bool next(CommitRecord& r) override;
+    std::size_t read(CommitRecord* out, std::size_t n) override;
+
+private:
+    int fd_ = -1;
+    bool owns_fd_ = false;
+
+    // mmap'd file
+    const unsigned char* map_ = nullptr;
+    std::size_t map_size_ = 0;
+    std::size_t map_pos_ = 0;
+
+    // streamed input
+    std::vector<unsigned char> buf_;
+    std::size_t buf_pos_ = 0;
+    std::size_t buf_len_ = 0;
+
+    bool read_exact(void* dst, std::size_t n);
+};
+
+// Runs a second CPU as the reference model, one instruction per next().
+// The trace ends when the reference stops (EBREAK, ECALL, fault, exit).
+class CpuCommitSource : public CommitSource, private CommitSink {
+public:
+    explicit CpuCommitSource(CPU& ref);
+    ~CpuCommitSource() override;
+
+    bool next(CommitRecord& r) override;
+
+private:
+    CPU& cpu_;
+    CommitRecord last_{};
+    bool got_ = false;
+    bool ended_ = false;
+
+    void commit(const CommitRecord& r) override { last_ = r; got_ = true; }
+};
+
+// Thrown from CosimChecker::commit() once the checker has seen a mismatch.
+class CosimDivergence : public std::runtime_error {
+public:
+    explicit CosimDivergence(const std::string& report)
+        : std::runtime_error("COSIM_DIVERGENCE"), report_(report) {}
+    const std::string& report() const { return report_; }
+
+private:
+    std::string report_;
+};
+
+// Compares the CPU's commits against a golden source on a second thread.
+//
+// commit() only copies the record into a single-producer/single-consumer
+// ring; the checker thread pulls golden records (reading the log or stepping
+// the reference CPU) and compares. When it finds a mismatch it records the
+// expected and actual records with the preceding matches, and the next
+// commit() throws CosimDivergence. The simulated CPU may by then have run
+// up to one ring's worth of instructions past the divergence.
+class CosimChecker : public CommitSink {
+public:
+    explicit CosimChecker(CommitSource& golden, std::size_t ring_records = 1 << 16,
+                          std::size_t context = 8);
+    ~CosimChecker() override;
+
+    CosimChecker(const CosimChecker&) = delete;
+    CosimChecker& operator=(const CosimChecker&) = delete;
+
+    void commit(const CommitRecord& r) override {
+        ring_[head_ & mask_] = r;
+        if (++head_ - published_ >= kPublishEvery) publish();
+    }
+
+    // Drain the ring and stop the checker thread. A golden trace that goes
+    // on after the last commit counts as a divergence. Returns true if
+    // everything matched; report() explains otherwise.
+    bool finish();
+
+    uint64_t checked() const { return checked_.load(std::memory_order_acquire); }
+    bool diverged() const { return diverged_.load(std::memory_order_acquire); }
+    const std::string& report() const { return report_; }
+
+private:
+    static constexpr uint64_t kPublishEvery = 64;
+
+    CommitSource& golden_;
+    std::vector<CommitRecord> ring_;
+    uint64_t mask_;
+    std::size_t context_;
+
+    // producer side
+    uint64_t head_ = 0;
+    uint64_t published_ = 0;
+    uint64_t tail_cache_ = 0;
+
+    alignas(64) std::atomic<uint64_t> head_shared_{0};
+    alignas(64) std::atomic<uint64_t> tail_shared_{0};
+    std::atomic<bool> producer_done_{false};
+    std::atomic<bool> diverged_{false};
+    std::atomic<uint64_t> checked_{0};
+
+    // checker thread; the last context_ matches feed the report
+    std::vector<CommitRecord> history_;
+    std::size_t history_pos_ = 0;
+    std::string report_;
+
+    std::thread thread_;
+    bool finished_ = false;
+
+    void publish();
+    void check_loop();
+    void remember(const CommitRecord* r, std::size_t n);
+    void diverge(const CommitRecord* expected, const CommitRecord* actual);
+};
+
+std::string format_commit(const CommitRecord& r);
+
+} // namespace rv
@@ -1,22 +1,120 @@
 
 #pragma once
+#include "rv/decode.hpp"
+#include "rv/isa.hpp"
+#include "rv/stats.hpp"
 #include <array>
 #include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 
 namespace rv {
 
+class CommitSink;
 class Memory;
 
+// Thrown when the guest stops the simulation: EBREAK, or ECALL with no
+// handler installed (and exceptions not trapped). what() is "EBREAK" or
+// "ECALL".
+class GuestStop : public std::runtime_error {
+public:
+    enum class Reason { Ebreak, Ecall };
+    explicit GuestStop(Reason reason)
+        : std::runtime_error(reason == Reason::Ebreak ? "EBREAK" : "ECALL"), reason_(reason) {}
+    Reason reason() const { return reason_; }
+
+private:
+    Reason reason_;
+};
+
 class CPU {
 public:
     explicit CPU(Memory& mem);
 
     void reset(uint32_t pc_start = 0);
+    // Execute one instruction, taking a pending interrupt first if one is
+    // enabled. Same as run(1).
     void step();
 
+    // Execute up to max_instructions. Stops early only by throwing, the
+    // same way step() does; instret() tells how far it got.
+    //
+    // Interrupts are not polled per instruction. Before each stretch the loop
+    // fires due events and takes an enabled interrupt, then runs straight up
+    // to the next scheduled event. Anything that can make an interrupt
+    // deliverable mid-stretch (writes to mstatus/mie/mip, MRET,
+    // raise_interrupt(), schedule()) cuts the stretch short instead.
+    void run(uint64_t max_instructions);
+
     uint32_t reg(int i) const { return regs_[i]; }
+    void set_reg(int i, uint32_t value) { if (i != 0) regs_[i] = value; }
+    uint32_t pc() const { return pc_; }
+    void set_pc(uint32_t pc) { pc_ = pc; }
+
+    // Called for ECALL instead of stopping. The handler sees the CPU before
+    // the PC moves on, so it can read a0-a7 and write results back; it may
+    // throw to stop the simulation.
+    using EcallHandler = std::function<void(CPU&)>;
+    void set_ecall_handler(EcallHandler handler) { ecall_handler_ = std::move(handler); }
+
+    // By default illegal instructions, misaligned accesses, EBREAK and an
+    // unhandled ECALL stop the simulation with a runtime_error. With
+    // exceptions trapped they go to mtvec like on hardware, setting
+    // mepc/mcause/mtval, which is what the riscv-tests environment expects.
+    // A trap whose handler is the faulting instruction itself still stops.
+    void set_trap_exceptions(bool on) { trap_exceptions_ = on; }
+
+    void set_isa(const Isa& isa) { isa_ = isa; flush_decode_cache(); }
+    const Isa& isa() const { return isa_; }
+
+    // Decoded instructions are cached per PC. Like a hardware I-cache, the
+    // cache does not snoop stores: code that rewrites instructions must
+    // execute FENCE.I, and hosts that reload memory must call reset() or
+    // flush_decode_cache(). The cache is direct-mapped and allocated on
+    // first use; entries must be a power of two.
+    void flush_decode_cache();
+    void set_decode_cache_size(std::size_t entries);
+
+    // Instructions retired since reset.
+    uint64_t instret() const { return instret_; }
+
+    // Breakpoints throw DebugStop (rv/debug.hpp) before the instruction at
+    // pc executes. They live in the decode cache as Op::Breakpoint entries,
+    // so execution elsewhere pays nothing for them.
+    void add_breakpoint(uint32_t pc);
+    void remove_breakpoint(uint32_t pc);
+    void clear_breakpoints();
+
+    // Instruction-mix counters since reset.
+    const Stats& stats() const { return stats_; }
+
+    // Machine interrupt causes, as bit numbers in mip/mie.
+    static constexpr uint32_t kIrqSoftware = 3;
+    static constexpr uint32_t kIrqTimer    = 7;
+    static constexpr uint32_t kIrqExternal = 11;
+
+    // Set or clear an interrupt-pending bit in mip. Devices use this; guest
+    // writes to these bits of mip are ignored.
+    void raise_interrupt(uint32_t irq);
+    void clear_interrupt(uint32_t irq);
+
+    // Call fn once instret() reaches `when` (immediately before the next
+    // instruction if it already has). Events are dropped by reset().
+    using Event = std::function<void()>;
+    void schedule(uint64_t when, Event fn);
+
+    // Report every retired instruction to sink (nullptr to stop). Used for
+    // commit logs and co-simulation; see rv/cosim.hpp.
+    void set_commit_sink(CommitSink* sink) { commit_sink_ = sink; }
+
+    // Trace lines go to std::cout unless redirected.
     void set_trace(bool on) { trace_ = on; }
+    void set_trace_output(std::ostream& out) { trace_out_ = &out; }
     bool trace_enabled() const { return trace_; }
     
     uint32_t csr_read(uint32_t addr) const;
@@ -28,8 +126,68 @@ private:
     Memory& mem_;
     uint32_t pc_ = 0;
     std::array<uint32_t, 32> regs_{};
+    uint64_t instret_ = 0;
+    Stats stats_;
+    Isa isa_;
     bool trace_ = false;
-    std::array<uint32_t, 4096> csr_{}; // 4096 CSRs (12-bit address space)
+    std::ostream* trace_out_;
+    CommitSink* commit_sink_ = nullptr;
+    EcallHandler ecall_handler_;
+    // Only CSRs that have been written, as (address, value). Guests touch a
+    // handful, so a short list beats a 16 KiB table for the full 12-bit space.
+    std::vector<std::pair<uint16_t, uint32_t>> csr_;
+
+    // Trap CSRs live outside csr_: they are read on every stretch boundary.
+    uint32_t mstatus_ = 0;
+    uint32_t mie_ = 0;
+    uint32_t mip_ = 0;
+    uint32_t mtvec_ = 0;
+    uint32_t mepc_ = 0;
+    uint32_t mcause_ = 0;
+    uint32_t mtval_ = 0;
+    bool trap_exceptions_ = false;
+
+    // Thrown by raise() once the trap is set up; run() resumes at mtvec.
+    struct TrapEntered {};
+
+    // Min-heap on `when`. seq breaks ties so events at the same instret fire
+    // in the order they were scheduled.
+    struct PendingEvent {
+        uint64_t when;
+        uint64_t seq;
+        Event fn;
+        bool operator>(const PendingEvent& o) const {
+            return when != o.when ? when > o.when : seq > o.seq;
+        }
+    };
+    std::priority_queue<PendingEvent, std::vector<PendingEvent>, std::greater<PendingEvent>> events_;
+    uint64_t event_seq_ = 0;
+
+    // run() executes without checks while instret_ < stretch_end_.
+    uint64_t stretch_end_ = 0;
+
+    std::vector<uint32_t> breakpoints_; // sorted
+    // After a DebugStop, the next run() executes the instruction at
+    // resume_pc_ once with breakpoints and watchpoints ignored.
+    bool resume_pending_ = false;
+    uint32_t resume_pc_ = 0;
+    bool stepping_over_ = false;
+
+    std::vector<DecodedInst> dcache_;
+    std::size_t dcache_entries_ = 4096;
+
+    const DecodedInst& fetch();
+    void fill(DecodedInst& d);
+    DecodedInst decode_at(uint32_t pc);
+    void invalidate(uint32_t pc);
+    void execute(const DecodedInst& d);
+    void step_over();
+    void end_stretch() { stretch_end_ = instret_ + 1; }
+    void service_events();
+    void take_interrupt();
+    [[noreturn]] void raise(uint32_t cause, uint32_t tval, const char* stop);
+    void enter_trap(uint32_t cause, uint32_t handler);
+    void print_trace(const DecodedInst& d, int wb_reg, uint32_t wb_val) const;
 
 };
 
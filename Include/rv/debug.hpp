@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+
+namespace rv {
+
+class CPU;
+
+// Thrown when execution reaches a breakpoint (CPU::add_breakpoint) or
+// touches a watched range (Memory::add_watchpoint). The instruction has not
+// executed: pc() still points at it and nothing was written. Calling run()
+// or step() again resumes, executing that instruction once without
+// stopping on it.
+class DebugStop : public std::runtime_error {
+public:
+    enum class Kind : uint8_t { Breakpoint, Watchpoint };
+
+    DebugStop(Kind kind, uint32_t addr, uint32_t size = 0, bool write = false)
+        : std::runtime_error(kind == Kind::Breakpoint ? "BREAKPOINT" : "WATCHPOINT"),
+          kind_(kind), addr_(addr), size_(size), write_(write) {}
+
+    Kind kind() const { return kind_; }
+    uint32_t addr() const { return addr_; }  // PC, or the data address accessed
+    uint32_t size() const { return size_; }  // access size (watchpoints)
+    bool is_write() const { return write_; }
+
+private:
+    Kind kind_;
+    uint32_t addr_;
+    uint32_t size_;
+    bool write_;
+};
+
+// Human-readable stop reason, PC, instret and the register file.
+void write_machine_state(std::ostream& out, const CPU& cpu, const DebugStop* why = nullptr);
+
+} // namespace rv
@@ -0,0 +1,55 @@
+#pragma once
+#include "rv/isa.hpp"
+#include <cstdint>
+
+namespace rv {
+
+class Memory;
+
+enum class Op : uint8_t {
+    Illegal,
+    Lui, Auipc, Jal, Jalr,
+    Beq, Bne, Blt, Bge, Bltu, Bgeu,
+    Lb, Lh, Lw, Lbu, Lhu,
+    Sb, Sh, Sw,
+    Addi, Slti, Sltiu, Xori, Ori, Andi, Slli, Srli, Srai,
+    Add, Sub, Sll, Slt, Sltu, Xor, Srl, Sra, Or, And,
+    Mul, Mulh, Mulhsu, Mulhu, Div, Divu, Rem, Remu,
+    Fence, FenceI,
+    Ecall, Ebreak, Mret, Wfi,
+    Csrrw, Csrrs, Csrrc, Csrrwi, Csrrsi, Csrrci,
+    Breakpoint, // never decoded; CPU marks cache entries at breakpoint PCs
+    Count
+};
+
+// One instruction, decoded once and then executed from the decode cache.
+// Compressed instructions are stored expanded to their 32-bit equivalent;
+// raw keeps the original encoding and len how far the PC advances.
+struct DecodedInst {
+    uint32_t pc = 0xFFFFFFFFu; // cache tag
+    uint32_t inst = 0;
+    uint32_t raw = 0;
+    int32_t imm = 0;           // immediate, shamt, or CSR address
+    Op op = Op::Illegal;
+    uint8_t rd = 0;
+    uint8_t rs1 = 0;           // also zimm for the CSR immediate forms
+    uint8_t rs2 = 0;
+    uint8_t len = 4;
+};
+
+// Decode a 32-bit instruction. Extensions not enabled in isa decode as
+// Op::Illegal. pc/raw/len are left for the caller to fill in.
+DecodedInst decode(uint32_t inst, const Isa& isa);
+
+// Fetch and decode the instruction at pc. With C enabled this reads 16-bit
+// parcels (so pc need only be 2-byte aligned) and expands compressed ones;
+// otherwise it is a single aligned 32-bit load. Fills in pc/raw/len.
+DecodedInst fetch_decode(const Memory& mem, uint32_t pc, const Isa& isa);
+
+// Expand an RV32C parcel to the equivalent 32-bit instruction, or return 0
+// (an illegal encoding) if the parcel is reserved or not RV32C.
+uint32_t expand_compressed(uint16_t parcel);
+
+const char* op_name(Op op);
+
+} // namespace rv
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+namespace rv {
+
+// A memory-mapped device. Memory routes any access that falls inside a
+// mapped region here; offset is relative to the region base and size is
+// the access width in bytes (1, 2 or 4).
+class Device {
+public:
+    virtual ~Device() = default;
+
+    virtual uint32_t read(uint32_t offset, int size) = 0;
+    virtual void write(uint32_t offset, uint32_t value, int size) = 0;
+
+    // True if reads depend only on simulated state (instret, earlier guest
+    // writes), so record/replay need not log them.
+    virtual bool deterministic_reads() const { return false; }
+};
+
+} // namespace rv
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+
+namespace rv {
+
+class Memory;
+
+// What load_elf() found: the entry point, the end of the highest loaded
+// segment, and the symbol table (if the file has one).
+struct ElfImage {
+    uint32_t entry = 0;
+    uint32_t end = 0;
+    std::map<std::string, uint32_t> symbols;
+
+    std::optional<uint32_t> symbol(const std::string& name) const {
+        auto it = symbols.find(name);
+        if (it == symbols.end()) return std::nullopt;
+        return it->second;
+    }
+};
+
+// Loads a statically linked ELF32 little-endian RISC-V executable: every
+// PT_LOAD segment is copied to its physical address and its bss zeroed.
+// All segments must lie in RAM. Throws runtime_error on anything else.
+ElfImage load_elf(Memory& mem, const std::string& path);
+ElfImage load_elf(Memory& mem, const void* data, std::size_t size);
+
+} // namespace rv
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+
+namespace rv {
+
+// Extensions enabled on top of the RV32I base.
+struct Isa {
+    bool m = false;      // integer multiply/divide
+    bool c = false;      // compressed instructions
+    bool zicntr = false; // cycle/time/instret counter CSRs
+};
+
+// Parse an ISA string such as "rv32i", "rv32imc", "rv32im_zicntr" or GCC's
+// "rv32imc_zicsr_zifencei".
+// Throws std::invalid_argument for anything this simulator can't run.
+Isa parse_isa(const std::string& isa);
+
+} // namespace rv
@@ -1,15 +1,34 @@
 #pragma once
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace rv {
 
+class Device;
+class InputLog;
+
+// Guest RAM at [base, base + size), plus memory-mapped devices outside it.
+//
+// RAM is allocated lazily in 4 KiB pages: a page costs nothing until the
+// first store to it, and reads of untouched pages return zero. This keeps
+// many small machines cheap when each only uses a few pages.
 class Memory {
 public:
-    explicit Memory(std::size_t size_bytes);
+    static constexpr uint32_t kPageShift = 12;
+    static constexpr uint32_t kPageSize = 1u << kPageShift;
+
+    // base must be page-aligned, e.g. 0x80000000 for riscv-tests images.
+    explicit Memory(std::size_t size_bytes, uint32_t base = 0);
+
+    // Returns the number of bytes loaded.
+    std::size_t load_binary(const std::string& path, uint32_t base = 0);
 
-    void load_binary(const std::string& path, uint32_t base = 0);
+    // Map a device at [base, base + size). Regions must not overlap RAM or
+    // each other. RAM accesses never look at this table:
+    // only an access that misses RAM falls through to the device lookup.
+    void map_device(uint32_t base, uint32_t size, Device& dev);
 
     // Byte access
     uint8_t load8(uint32_t addr) const;
@@ -22,11 +41,110 @@ public:
     uint32_t load32(uint32_t addr) const;
     void store32(uint32_t addr, uint32_t value);
 
-    std::size_t size() const { return mem_.size(); }
+    // Bulk RAM transfer for host-side users (syscalls, loaders). The whole
+    // range must lie in RAM; devices are not reachable this way.
+    void read_block(uint32_t addr, void* dst, std::size_t nbytes) const;
+    void write_block(uint32_t addr, const void* src, std::size_t nbytes);
+
+    std::size_t size() const { return size_; }
+    uint32_t base() const { return base_; }
+
+    // Host bytes backing guest RAM, i.e. pages written so far.
+    std::size_t resident_bytes() const;
+
+    // RAM pages read or written so far (memory footprint).
+    std::size_t pages_touched() const;
+
+    // Watchpoints throw DebugStop (rv/debug.hpp) before an access that
+    // overlaps [addr, addr + len) goes ahead. Only pages holding a watch
+    // leave the fast path, so unwatched pages cost nothing. RAM only.
+    enum WatchAccess : uint8_t { kWatchRead = 1, kWatchWrite = 2 };
+    void add_watchpoint(uint32_t addr, uint32_t len, uint8_t access);
+    void remove_watchpoint(uint32_t addr, uint32_t len);
+    void clear_watchpoints();
+
+    // Throw the DebugStop that an access to [addr, addr + nbytes) would,
+    // without making it. Host code checks up front this way before a side
+    // effect it cannot undo, then copies with watchpoints suspended.
+    void check_watchpoints(uint32_t addr, uint32_t nbytes, uint8_t access) const;
+
+    // Used by the CPU while fetching instructions and stepping over a stop.
+    void suspend_watchpoints(bool on) { watch_suspended_ = on; }
+    bool watchpoints_suspended() const { return watch_suspended_; }
+
+    // Record or replay device reads (see rv/replay.hpp); the CPU and
+    // Syscalls on this memory use the same log. nullptr to stop.
+    void set_input_log(InputLog* log) { input_log_ = log; }
+    InputLog* input_log() const { return input_log_; }
 
 private:
-    std::vector<uint8_t> mem_;
+    struct Region {
+        uint32_t base;
+        uint32_t size;
+        Device* dev;
+    };
+
+    struct Watchpoint {
+        uint32_t addr;
+        uint32_t len;
+        uint8_t access;
+    };
+
+    std::size_t size_;
+    uint32_t base_;
+    std::vector<std::unique_ptr<uint8_t[]>> pages_; // null until first store
+    // What loads and stores use: pages_ entries, except null for pages
+    // that are unbacked or watched, which take the slow path.
+    std::vector<uint8_t*> fast_;
+    mutable std::vector<bool> zero_read_;            // unbacked pages that were read
+    std::vector<Watchpoint> watchpoints_;
+    std::vector<bool> watched_;                      // per page
+    bool watch_suspended_ = false;
+    std::vector<Region> regions_;      // sorted by base
+    mutable std::size_t last_region_ = 0;
+    InputLog* input_log_ = nullptr;
+
+    // Addresses below base_ wrap around to large offsets and fail too.
+    bool in_ram(uint32_t addr, std::size_t nbytes) const {
+        return static_cast<std::size_t>(addr - base_) + nbytes <= size_;
+    }
+    std::size_t page_index(uint32_t addr) const { return (addr - base_) >> kPageShift; }
+
+    // Aligned accesses never straddle a page, so one lookup covers them.
+    // read_page() returns null for an unbacked page, which reads as zero.
+    const uint8_t* read_page(uint32_t addr, uint32_t nbytes) const {
+        const uint8_t* p = fast_[page_index(addr)];
+        return p ? p : read_page_slow(addr, nbytes);
+    }
+    uint8_t* write_page(uint32_t addr, uint32_t nbytes) {
+        uint8_t* p = fast_[page_index(addr)];
+        return p ? p : write_page_slow(addr, nbytes);
+    }
+    const uint8_t* read_page_slow(uint32_t addr, uint32_t nbytes) const;
+    uint8_t* write_page_slow(uint32_t addr, uint32_t nbytes);
+    void check_watch(uint32_t addr, uint32_t nbytes, uint8_t access) const;
+    void rebuild_watched_pages();
     void check_addr(uint32_t addr, std::size_t nbytes) const;
+    const Region& find_region(uint32_t addr, std::size_t nbytes) const;
+    uint32_t device_read(uint32_t addr, int nbytes) const;
+    void device_write(uint32_t addr, uint32_t value, int nbytes);
+};
+
+// Watchpoints watch the guest's data accesses. Instruction fetch and device
+// DMA are not those, so they run with watchpoints suspended.
+class SuspendWatchpoints {
+public:
+    explicit SuspendWatchpoints(Memory& mem) : mem_(mem), prev_(mem.watchpoints_suspended()) {
+        mem_.suspend_watchpoints(true);
+    }
+    ~SuspendWatchpoints() { mem_.suspend_watchpoints(prev_); }
+
+    SuspendWatchpoints(const SuspendWatchpoints&) = delete;
+    SuspendWatchpoints& operator=(const SuspendWatchpoints&) = delete;
+
+private:
+    Memory& mem_;
+    bool prev_;
 };
 
-} // namespace rv
\ No newline at end of file
+} // namespace rv
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rv {
+
+inline constexpr char kReplayLogMagic[8] = {'R', 'V', 'R', 'E', 'P', 'L', '0', '1'};
+
+// Thrown during replay when the guest asks for an input the log does not
+// have next: the run has diverged from the recording, or gone past its end.
+class ReplayDivergence : public std::runtime_error {
+public:
+    explicit ReplayDivergence(const std::string& report)
+        : std::runtime_error("REPLAY_DIVERGENCE"), report_(report) {}
+    const std::string& report() const { return report_; }
+
+private:
+    std::string report_;
+};
+
+// Every value that enters the guest from outside the simulation, in the
+// order the guest consumed it: MMIO device reads, syscall results and the
+// data syscalls and block-device DMA store into guest RAM. Attached with
+// Memory::set_input_log(), where Syscalls and devices find it too.
+//
+// Counter CSRs and the CLINT's mtime follow instret, so they are the same
+// on every run and are not logged.
+//
+// Recording appends each value to the log as it is consumed. Replaying
+// hands the logged values back instead and leaves the host alone: devices
+// are not read, the block device neither reads nor writes its image, and
+// syscalls other than brk/exit are not executed (writes to guest stdout
+// and stderr are still shown). With the same program and options, the
+// guest then follows exactly the recorded path, however often it is
+// replayed.
+//
+// The log is a tag byte per entry followed by LEB128 fields, so a typical
+// MMIO status poll costs two bytes.
+class InputLog {
+public:
+    enum class Mode { Record, Replay };
+    enum class Kind : uint8_t {
+        Device  = 1, // MMIO read or device command result
+        Syscall = 2, // syscall number and return value
+        Data    = 3, // bytes a syscall or DMA stored into guest memory
+    };
+
+    InputLog(const std::string& path, Mode mode);
+    ~InputLog();
+
+    InputLog(const InputLog&) = delete;
+    InputLog& operator=(const InputLog&) = delete;
+
+    bool replaying() const { return mode_ == Mode::Replay; }
+
+    // Record: log live and return it. Replay: return the logged value.
+    uint32_t value(Kind kind, uint32_t live);
+
+    // Syscalls and DMA: the memory the host filled in, then the result.
+    void record_data(uint32_t addr, const void* data, std::size_t n);
+    void record_syscall(uint32_t number, uint32_t ret);
+    // Replay: false when the next entry is the result, not data.
+    bool replay_data(uint32_t& addr, std::vector<uint8_t>& data);
+    uint32_t replay_syscall(uint32_t number);
+
+    void flush();
+    uint64_t entries() const { return entries_; }
+
+private:
+    Mode mode_;
+    std::string path_;
+    uint64_t entries_ = 0;
+
+    // record
+    std::FILE* f_ = nullptr;
+    std::vector<uint8_t> out_;
+
+    // replay
+    std::vector<uint8_t> in_;
+    std::size_t pos_ = 0;
+
+    void put(uint64_t v);
+    uint64_t get();
+    void expect(Kind kind);
+};
+
+} // namespace rv
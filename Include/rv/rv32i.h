@@ -0,0 +1,86 @@
+/*
+ * C API for embedding the simulator in-process.
+ *
+ * A machine is a CPU plus its RAM. Different machines may run on different
+ * threads at the same time; one machine must not be used from two threads
+ * at once. No C++ exception crosses this boundary: failures are reported
+ * through return values and rv32i_last_error().
+ */
+#ifndef RV32I_H
+#define RV32I_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  define RV32I_API
+#else
+#  define RV32I_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rv32i_machine rv32i_machine;
+
+typedef enum rv32i_status {
+    RV32I_OK = 0,      /* rv32i_run: instruction budget used up */
+    RV32I_EBREAK = 1,  /* guest executed EBREAK */
+    RV32I_EXITED = 2,  /* guest called exit; see rv32i_exit_code() */
+    RV32I_ECALL = 3,   /* ECALL with no handler installed */
+    RV32I_STOPPED = 4, /* a callback asked to stop */
+    RV32I_ERROR = -1   /* fault or bad argument; see rv32i_last_error() */
+} rv32i_status;
+
+/* Returns 0 to resume the guest after the ECALL, nonzero to stop the run
+ * with RV32I_STOPPED (the PC is left on the ECALL). */
+typedef int (*rv32i_ecall_fn)(rv32i_machine* m, void* user);
+
+typedef uint32_t (*rv32i_mmio_read_fn)(void* user, uint32_t offset, int size);
+typedef void (*rv32i_mmio_write_fn)(void* user, uint32_t offset, uint32_t value, int size);
+
+/* isa is an ISA string such as "rv32imc"; NULL means "rv32i".
+ * Returns NULL if the arguments are invalid. */
+RV32I_API rv32i_machine* rv32i_create(uint32_t mem_size, const char* isa);
+RV32I_API void rv32i_destroy(rv32i_machine* m);
+
+RV32I_API rv32i_status rv32i_load_image(rv32i_machine* m, const void* data, size_t size, uint32_t base);
+RV32I_API rv32i_status rv32i_load_file(rv32i_machine* m, const char* path, uint32_t base);
+
+/* Clears registers and CSRs and sets the PC. Memory is left alone. */
+RV32I_API void rv32i_reset(rv32i_machine* m, uint32_t pc);
+
+/* Runs at most budget instructions. *executed (if not NULL) receives the
+ * number actually retired. */
+RV32I_API rv32i_status rv32i_run(rv32i_machine* m, uint64_t budget, uint64_t* executed);
+
+RV32I_API uint32_t rv32i_get_reg(const rv32i_machine* m, int reg);
+RV32I_API void rv32i_set_reg(rv32i_machine* m, int reg, uint32_t value);
+RV32I_API uint32_t rv32i_get_pc(const rv32i_machine* m);
+RV32I_API void rv32i_set_pc(rv32i_machine* m, uint32_t pc);
+RV32I_API uint64_t rv32i_instret(const rv32i_machine* m);
+
+/* RAM only; MMIO regions are not reachable this way. rv32i_write_mem drops
+ * the decoded-instruction cache, so patched code takes effect on the next
+ * run. */
+RV32I_API rv32i_status rv32i_read_mem(const rv32i_machine* m, uint32_t addr, void* dst, size_t size);
+RV32I_API rv32i_status rv32i_write_mem(rv32i_machine* m, uint32_t addr, const void* src, size_t size);
+
+/* Route ECALLs to the built-in newlib syscall emulation (heap starting at
+ * heap_base), or to a callback. The last call wins. */
+RV32I_API void rv32i_enable_syscalls(rv32i_machine* m, uint32_t heap_base);
+RV32I_API void rv32i_set_ecall_handler(rv32i_machine* m, rv32i_ecall_fn fn, void* user);
+
+/* Map a callback-backed device at [base, base + size), above RAM. */
+RV32I_API rv32i_status rv32i_map_mmio(rv32i_machine* m, uint32_t base, uint32_t size,
+                                      rv32i_mmio_read_fn read, rv32i_mmio_write_fn write, void* user);
+
+RV32I_API int rv32i_exit_code(const rv32i_machine* m);
+RV32I_API const char* rv32i_last_error(const rv32i_machine* m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RV32I_H */
@@ -0,0 +1,97 @@
+#pragma once
+#include "rv/cpu.hpp"
+#include "rv/isa.hpp"
+#include "rv/memory.hpp"
+#include "rv/syscall.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rv {
+
+// One guest: its RAM, its hart, and how it finished.
+struct Machine {
+    enum class Status : uint8_t { Runnable, Ebreak, Ecall, Exited, Budget, Fault };
+
+    explicit Machine(std::size_t mem_size, const Isa& isa = {});
+
+    // Handle ECALLs with the newlib syscall emulation.
+    void enable_syscalls(uint32_t heap_base);
+
+    Memory mem;
+    CPU cpu;
+    std::unique_ptr<Syscalls> sys;
+
+    uint64_t budget = ~uint64_t{0}; // stop with Status::Budget after this many instructions
+    uint64_t id = 0;                // caller's tag, untouched by the scheduler
+    Status status = Status::Runnable;
+    int exit_code = 0;
+    std::string fault;
+};
+
+// Time-slices many small machines over a fixed pool of worker threads.
+//
+// Each worker has its own run queue. A worker takes a machine from the front
+// of its queue, runs it for one quantum and, if it is still runnable, puts it
+// back at the end. A worker whose queue is empty steals from the back of
+// another worker's queue. Finished machines are handed back by wait().
+class Scheduler {
+public:
+    struct Options {
+        unsigned workers = 0;                 // 0: one per hardware thread
+        uint64_t quantum = 10000;             // instructions per time slice
+        std::size_t decode_cache_entries = 64;
+    };
+
+    Scheduler() : Scheduler(Options{}) {}
+    explicit Scheduler(const Options& opts);
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Thread-safe. The machine is reset by the caller; the scheduler only
+    // shrinks its decode cache to Options::decode_cache_entries.
+    void submit(std::unique_ptr<Machine> m);
+
+    // Block until every submitted machine has finished and return them,
+    // in completion order.
+    std::vector<std::unique_ptr<Machine>> wait();
+
+    unsigned workers() const { return static_cast<unsigned>(queues_.size()); }
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct Queue {
+        std::mutex mu;
+        std::deque<std::unique_ptr<Machine>> q;
+    };
+
+    Options opts_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mu_;                   // guards done_, outstanding_, queued_ waits
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::vector<std::unique_ptr<Machine>> done_;
+    std::size_t outstanding_ = 0;
+
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<std::size_t> next_queue_{0};
+    std::atomic<uint64_t> steals_{0};
+    bool stop_ = false;
+
+    void worker(std::size_t self);
+    std::unique_ptr<Machine> take(std::size_t self);
+    void run_slice(Machine& m);
+    void publish_queued();
+};
+
+} // namespace rv
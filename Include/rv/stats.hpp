@@ -0,0 +1,32 @@
+#pragma once
+#include "rv/decode.hpp"
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+namespace rv {
+
+class Memory;
+
+// Counters the CPU keeps for every retired instruction. Updating them is an
+// array increment indexed by the decoded op, so they are always on.
+// Loads/stores by width, CSR accesses etc. are sums over `retired`.
+struct Stats {
+    std::array<uint64_t, (std::size_t)Op::Count> retired{};
+    uint64_t branches_taken = 0;
+    uint64_t interrupts = 0;
+    uint64_t exceptions = 0; // trapped to mtvec, see CPU::set_trap_exceptions()
+
+    uint64_t count(Op op) const { return retired[(std::size_t)op]; }
+    uint64_t total() const;
+    uint64_t branches() const;
+    uint64_t csr_accesses() const;
+    uint64_t loads(int width) const;  // width in bytes: 1, 2 or 4
+    uint64_t stores(int width) const;
+};
+
+// One JSON object: totals, per-mnemonic and per-class counts, memory access
+// widths, branch outcomes, CSR accesses and the RAM footprint of mem.
+void write_stats_json(std::ostream& out, const Stats& s, const Memory& mem);
+
+} // namespace rv
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace rv {
+
+class CPU;
+class InputLog;
+class Memory;
+
+// Thrown by the exit syscall. Carries the guest's exit status.
+class GuestExit : public std::runtime_error {
+public:
+    explicit GuestExit(int code) : std::runtime_error("EXIT"), code_(code) {}
+    int code() const { return code_; }
+
+private:
+    int code_;
+};
+
+// Proxy-kernel style syscall emulation for newlib guests. Dispatches on a7,
+// takes arguments in a0-a5 and returns the result (or -errno) in a0, using
+// the riscv-pk syscall numbers. Guest fds 0-2 map to the host's stdio.
+//
+// With an input log on the memory (rv/replay.hpp), results and the bytes
+// stored into the guest are recorded; on replay they come from the log and
+// the host is left alone.
+class Syscalls {
+public:
+    enum Number : uint32_t {
+        kOpenat       = 56,
+        kClose        = 57,
+        kLseek        = 62,
+        kRead         = 63,
+        kWrite        = 64,
+        kFstat        = 80,
+        kExit         = 93,
+        kExitGroup    = 94,
+        kGettimeofday = 169,
+        kBrk          = 214,
+        kOpen         = 1024,
+    };
+
+    explicit Syscalls(Memory& mem);
+    ~Syscalls();
+
+    Syscalls(const Syscalls&) = delete;
+    Syscalls& operator=(const Syscalls&) = delete;
+
+    // Route cpu's ECALLs here.
+    void install(CPU& cpu);
+
+    // Like riscv-pk, start the stack at the top of RAM: sp points at a
+    // zeroed argc/argv/envp/auxv block, i.e. argc = 0 and empty lists, which
+    // is what newlib's crt0 reads before calling main. Call after reset().
+    void init_stack(CPU& cpu);
+
+    // Program break starts at heap_base and may grow up to the end of RAM.
+    void set_heap_base(uint32_t heap_base) { heap_base_ = brk_ = heap_base; }
+
+    // Send the guest's stdout to another host fd, e.g. 2 when the host's
+    // stdout carries binary output.
+    void set_stdout_fd(int host_fd) { fds_[1] = host_fd; }
+
+    void handle(CPU& cpu);
+
+private:
+    Memory& mem_;
+    std::vector<int> fds_; // guest fd -> host fd, -1 if closed
+    uint32_t heap_base_ = 0;
+    uint32_t brk_ = 0;
+
+    bool in_ram(uint32_t addr, std::size_t nbytes) const;
+    uint32_t dispatch(CPU& cpu);
+    uint32_t replay(CPU& cpu, InputLog& log);
+    // DebugStop now if the call's guest buffers are watched (see handle()).
+    void check_watchpoints(const CPU& cpu) const;
+    // write_block() that also records the bytes when there is an input log
+    void copy_out(uint32_t addr, const void* data, std::size_t n);
+
+    int32_t sys_open(uint32_t path_addr, uint32_t flags, uint32_t mode);
+    int32_t sys_close(uint32_t fd);
+    int32_t sys_lseek(uint32_t fd, int32_t offset, uint32_t whence);
+    int32_t sys_read(uint32_t fd, uint32_t buf, uint32_t count);
+    int32_t sys_write(uint32_t fd, uint32_t buf, uint32_t count);
+    int32_t sys_fstat(uint32_t fd, uint32_t statbuf);
+    int32_t sys_gettimeofday(uint32_t tv);
+    uint32_t sys_brk(uint32_t addr);
+
+    int host_fd(uint32_t fd) const;
+};
+
+} // namespace rv
@@ -0,0 +1,45 @@
+#pragma once
+#include "rv/device.hpp"
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <string>
+
+namespace rv {
+
+// Minimal 16550-style console. Only THR/RBR (offset 0) and LSR (offset 5)
+// do anything. Transmitted bytes are collected on the host and written out
+// in large chunks, so firmware that logs one character at a time does not
+// cost one host write per character.
+class Uart : public Device {
+public:
+    static constexpr uint32_t kBase = 0x10000000u;
+    static constexpr uint32_t kSize = 0x100u;
+
+    static constexpr uint32_t kRegData = 0x0; // THR (write) / RBR (read)
+    static constexpr uint32_t kRegLsr  = 0x5; // line status
+
+    static constexpr uint32_t kLsrDataReady = 0x01;
+    static constexpr uint32_t kLsrThrEmpty  = 0x20;
+    static constexpr uint32_t kLsrTxIdle    = 0x40;
+
+    explicit Uart(std::ostream& out = std::cout, std::size_t flush_threshold = 4096);
+    ~Uart() override;
+
+    uint32_t read(uint32_t offset, int size) override;
+    void write(uint32_t offset, uint32_t value, int size) override;
+
+    // Queue bytes for the guest to read from RBR.
+    void push_input(const std::string& bytes);
+
+    // Hand everything buffered so far to the host stream.
+    void flush();
+
+private:
+    std::ostream& out_;
+    std::size_t flush_threshold_;
+    std::string tx_;
+    std::deque<uint8_t> rx_;
+};
+
+} // namespace rv
@@ -0,0 +1,92 @@
+// Aggregate throughput of BatchEngine against the same work on K scalar CPUs.
+//
+//   rv32i_bench_batch [lanes] [iterations]
+#include "rv/batch.hpp"
+#include "rv/cpu.hpp"
+#include "rv/memory.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    const std::size_t lanes = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 1024;
+    const uint32_t iters = argc > 2 ? (uint32_t)std::strtoul(argv[2], nullptr, 0) : 2000;
+
+    if (lanes == 0 || iters == 0 || iters > 2047) {
+        std::cerr << "Usage: rv32i_bench_batch [lanes] [iterations <= 2047]\n";
+        return 1;
+    }
+
+    // xorshift32 on x10, `iters` rounds; each lane gets a different seed.
+    uint32_t prog[] = {
+        0x00000293u,                 // addi x5,x0,0
+        0x00000313u | (iters << 20), // addi x6,x0,iters
+        0x00D51393u,                 // slli x7,x10,13
+        0x00754533u,                 // xor  x10,x10,x7
+        0x01155393u,                 // srli x7,x10,17
+        0x00754533u,                 // xor  x10,x10,x7
+        0x00551393u,                 // slli x7,x10,5
+        0x00754533u,                 // xor  x10,x10,x7
+        0x00128293u,                 // addi x5,x5,1
+        0xFE6292E3u,                 // bne  x5,x6,-28
+        0x00100073u                  // ebreak
+    };
+    const std::size_t mem_size = 4096;
+    const uint64_t budget = ~uint64_t{0};
+
+    using clock = std::chrono::steady_clock;
+
+    // Scalar: one CPU per input, run back to back.
+    uint64_t scalar_insts = 0;
+    uint32_t scalar_check = 0;
+    auto t0 = clock::now();
+    for (std::size_t k = 0; k < lanes; k++) {
+        rv::Memory mem(mem_size);
+        mem.write_block(0, prog, sizeof(prog));
+        rv::CPU cpu(mem);
+        cpu.reset(0);
+        cpu.set_reg(10, (uint32_t)(k + 1));
+        try { cpu.run(budget); } catch (...) {}
+        scalar_insts += cpu.instret();
+        scalar_check ^= cpu.reg(10);
+    }
+    auto t1 = clock::now();
+
+    // Lockstep
+    rv::BatchEngine batch(lanes, mem_size);
+    batch.load_image(prog, sizeof(prog), 0);
+    batch.reset(0);
+    for (std::size_t k = 0; k < lanes; k++) batch.set_reg(k, 10, (uint32_t)(k + 1));
+
+    auto t2 = clock::now();
+    batch.run(budget);
+    auto t3 = clock::now();
+
+    uint64_t batch_insts = 0;
+    uint32_t batch_check = 0;
+    for (std::size_t k = 0; k < lanes; k++) {
+        batch_insts += batch.instret(k);
+        batch_check ^= batch.reg(k, 10);
+    }
+
+    const double ts = std::chrono::duration<double>(t1 - t0).count();
+    const double tb = std::chrono::duration<double>(t3 - t2).count();
+
+    std::cout << "lanes=" << lanes << " iterations=" << iters
+              << " kernels=" << batch.kernel_name() << "\n";
+    std::cout << "scalar: " << scalar_insts << " insts in " << ts << " s, "
+              << (scalar_insts / ts / 1e6) << " MIPS\n";
+    std::cout << "batch:  " << batch_insts << " insts in " << tb << " s, "
+              << (batch_insts / tb / 1e6) << " MIPS"
+              << " (" << batch.lockstep_steps() << " lockstep steps, "
+              << batch.peeled_lanes() << " lanes peeled)\n";
+    std::cout << "speedup: " << (ts / tb) << "x\n";
+
+    if (scalar_check != batch_check || scalar_insts != batch_insts) {
+        std::cerr << "MISMATCH between scalar and batch results\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+// Many small guests time-sliced over a worker pool.
+//
+//   rv32i_bench_scheduler [machines] [workers] [quantum]
+#include "rv/scheduler.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    const std::size_t machines = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 100000;
+    rv::Scheduler::Options opts;
+    if (argc > 2) opts.workers = (unsigned)std::strtoul(argv[2], nullptr, 0);
+    if (argc > 3) opts.quantum = std::strtoull(argv[3], nullptr, 0);
+
+    if (machines == 0 || opts.quantum == 0) {
+        std::cerr << "Usage: rv32i_bench_scheduler [machines] [workers] [quantum > 0]\n";
+        return 1;
+    }
+
+    // x11 = 1 + 2 + ... + x10, stored at 0x8000 so every guest also touches
+    // a data page.
+    const uint32_t prog[] = {
+        0x00000593u, //  0: addi x11,x0,0
+        0x00050863u, //  4: beq  x10,x0,16
+        0x00A585B3u, //  8: add  x11,x11,x10
+        0xFFF50513u, // 12: addi x10,x10,-1
+        0xFF5FF06Fu, // 16: jal  x0,-12
+        0x00008637u, // 20: lui  x12,8
+        0x00B62023u, // 24: sw   x11,0(x12)
+        0x00100073u  // 28: ebreak
+    };
+    const std::size_t mem_size = 1u << 20; // 1 MiB address space, mostly never touched
+
+    using clock = std::chrono::steady_clock;
+    auto t0 = clock::now();
+
+    rv::Scheduler sched(opts);
+    for (std::size_t i = 0; i < machines; i++) {
+        auto m = std::make_unique<rv::Machine>(mem_size);
+        m->mem.write_block(0, prog, sizeof(prog));
+        m->cpu.reset(0);
+        m->cpu.set_reg(10, (uint32_t)(1000 + i % 1000));
+        m->id = i;
+        sched.submit(std::move(m));
+    }
+    auto done = sched.wait();
+    auto t1 = clock::now();
+
+    uint64_t insts = 0, resident = 0, bad = 0;
+    for (auto& m : done) {
+        const uint32_t n = (uint32_t)(1000 + m->id % 1000);
+        insts += m->cpu.instret();
+        resident += m->mem.resident_bytes();
+        if (m->status != rv::Machine::Status::Ebreak || m->cpu.reg(11) != n * (n + 1) / 2) bad++;
+    }
+
+    const double t = std::chrono::duration<double>(t1 - t0).count();
+    std::cout << "machines=" << machines << " workers=" << sched.workers()
+              << " quantum=" << opts.quantum << "\n";
+    std::cout << insts << " insts in " << t << " s, " << (insts / t / 1e6) << " MIPS, "
+              << (machines / t) << " machines/s, " << sched.steals() << " steals\n";
+    std::cout << "guest RAM resident: " << (resident / machines) << " bytes/machine\n";
+    std::cout << (bad ? "MISMATCH\n" : "results match\n");
+    return bad ? 1 : 0;
+}
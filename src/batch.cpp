@@ -0,0 +1,394 @@
+#include "rv/batch.hpp"
+#include "rv/cpu.hpp"
+#include "batch_kernels.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace rv {
+
+namespace {
+
+constexpr std::size_t kDecodeCacheEntries = 1024;
+
+bool alu_op(Op op, batch::AluOp& out) {
+    switch (op) {
+        case Op::Add:  case Op::Addi:  out = batch::AluOp::Add;  return true;
+        case Op::Sub:                  out = batch::AluOp::Sub;  return true;
+        case Op::And:  case Op::Andi:  out = batch::AluOp::And;  return true;
+        case Op::Or:   case Op::Ori:   out = batch::AluOp::Or;   return true;
+        case Op::Xor:  case Op::Xori:  out = batch::AluOp::Xor;  return true;
+        case Op::Sll:  case Op::Slli:  out = batch::AluOp::Sll;  return true;
+        case Op::Srl:  case Op::Srli:  out = batch::AluOp::Srl;  return true;
+        case Op::Sra:  case Op::Srai:  out = batch::AluOp::Sra;  return true;
+        case Op::Slt:  case Op::Slti:  out = batch::AluOp::Slt;  return true;
+        case Op::Sltu: case Op::Sltiu: out = batch::AluOp::Sltu; return true;
+        case Op::Mul:                  out = batch::AluOp::Mul;  return true;
+        default: return false;
+    }
+}
+
+bool branch_op(Op op, batch::CmpOp& out) {
+    switch (op) {
+        case Op::Beq:  out = batch::CmpOp::Eq;  return true;
+        case Op::Bne:  out = batch::CmpOp::Ne;  return true;
+        case Op::Blt:  out = batch::CmpOp::Lt;  return true;
+        case Op::Bge:  out = batch::CmpOp::Ge;  return true;
+        case Op::Bltu: out = batch::CmpOp::Ltu; return true;
+        case Op::Bgeu: out = batch::CmpOp::Geu; return true;
+        default: return false;
+    }
+}
+
+// RV32M ops without a SIMD kernel; same results as CPU::step().
+uint32_t muldiv(Op op, uint32_t a, uint32_t b) {
+    switch (op) {
+        case Op::Mulh:   return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+        case Op::Mulhsu: return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(uint64_t)b) >> 32);
+        case Op::Mulhu:  return (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32);
+        case Op::Div:
+            if (b == 0) return 0xFFFFFFFFu;
+            if (a == 0x80000000u && b == 0xFFFFFFFFu) return a;
+            return (uint32_t)((int32_t)a / (int32_t)b);
+        case Op::Divu: return (b == 0) ? 0xFFFFFFFFu : a / b;
+        case Op::Rem:
+            if (b == 0) return a;
+            if (a == 0x80000000u && b == 0xFFFFFFFFu) return 0;
+            return (uint32_t)((int32_t)a % (int32_t)b);
+        case Op::Remu: return (b == 0) ? a : a % b;
+        default: return 0;
+    }
+}
+
+// Ops after which every lane in the mask is still running and all of them
+// are at the same PC, so the next step can reuse the mask as is.
+bool keeps_lanes_together(Op op) {
+    switch (op) {
+        case Op::Add: case Op::Sub: case Op::And: case Op::Or: case Op::Xor:
+        case Op::Sll: case Op::Srl: case Op::Sra: case Op::Slt: case Op::Sltu:
+        case Op::Addi: case Op::Andi: case Op::Ori: case Op::Xori:
+        case Op::Slli: case Op::Srli: case Op::Srai: case Op::Slti: case Op::Sltiu:
+        case Op::Lui: case Op::Auipc: case Op::Jal: case Op::Mul: case Op::Fence:
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace
+
+BatchEngine::BatchEngine(std::size_t lanes, std::size_t mem_size, const Isa& isa)
+    : lanes_(lanes), stride_((lanes + 7) & ~std::size_t{7}), isa_(isa) {
+    if (lanes == 0) throw std::invalid_argument("BatchEngine needs at least one lane");
+
+    mems_.reserve(lanes_);
+    for (std::size_t k = 0; k < lanes_; k++) mems_.push_back(std::make_unique<Memory>(mem_size));
+
+    regs_.assign(32 * stride_, 0);
+    pcs_.assign(stride_, 0);
+    mask_.assign(stride_, 0);
+    waited_.assign(stride_, 0);
+    instret_.assign(lanes_, 0);
+    states_.assign(lanes_, LaneState::Running);
+    faults_.assign(lanes_, std::string());
+}
+
+void BatchEngine::load_image(const void* data, std::size_t size, uint32_t base) {
+    for (auto& m : mems_) m->write_block(base, data, size);
+    dcache_.clear();
+}
+
+void BatchEngine::reset(uint32_t pc) {
+    std::fill(regs_.begin(), regs_.end(), 0);
+    std::fill(pcs_.begin(), pcs_.end(), pc);
+    std::fill(waited_.begin(), waited_.end(), 0);
+    std::fill(instret_.begin(), instret_.end(), 0);
+    std::fill(states_.begin(), states_.end(), LaneState::Running);
+    std::fill(faults_.begin(), faults_.end(), std::string());
+    dcache_.clear();
+}
+
+const char* BatchEngine::kernel_name() const {
+    return batch::best_kernels().name;
+}
+
+const DecodedInst& BatchEngine::fetch(uint32_t pc, std::size_t lane) {
+    if (dcache_.empty()) dcache_.resize(kDecodeCacheEntries);
+    DecodedInst& d = dcache_[(pc >> 1) & (kDecodeCacheEntries - 1)];
+    if (d.pc != pc) d = fetch_decode(*mems_[lane], pc, isa_);
+    return d;
+}
+
+void BatchEngine::run(uint64_t max_instructions) {
+    steps_ = 0;
+    peeled_ = 0;
+    limit_ = max_instructions;
+
+    bool rescan = true;
+    bool converged = false; // every runnable lane is in the mask
+    uint32_t sel = 0;
+    std::size_t first = 0;
+    uint64_t pending = 0;   // steps retired by the current mask, not yet in instret_
+    uint64_t room = 0;      // steps the current mask can take before a lane hits the limit
+
+    auto credit = [&](uint64_t n) {
+        if (n == 0) return;
+        for (std::size_t k = 0; k < lanes_; k++) {
+            if (mask_[k]) instret_[k] += n;
+        }
+    };
+
+    for (;;) {
+        if (rescan) {
+            credit(pending);
+            pending = 0;
+
+            // Lowest PC among lanes that can still run.
+            bool any = false;
+            sel = 0xFFFFFFFFu;
+            for (std::size_t k = 0; k < lanes_; k++) {
+                if (states_[k] != LaneState::Running || instret_[k] >= max_instructions) continue;
+                any = true;
+                if (pcs_[k] < sel) sel = pcs_[k];
+            }
+            if (!any) break;
+
+            first = lanes_;
+            converged = true;
+            room = ~uint64_t{0};
+            for (std::size_t k = 0; k < lanes_; k++) {
+                mask_[k] = 0;
+                if (states_[k] != LaneState::Running || instret_[k] >= max_instructions) continue;
+                if (pcs_[k] == sel) {
+                    mask_[k] = ~0u;
+                    waited_[k] = 0;
+                    if (first == lanes_) first = k;
+                    room = std::min(room, max_instructions - instret_[k]);
+                } else {
+                    converged = false;
+                    if (++waited_[k] > peel_after_) peel(k, max_instructions - instret_[k]);
+                }
+            }
+        }
+
+        ++steps_;
+
+        const DecodedInst* d = nullptr;
+        try {
+            d = &fetch(sel, first);
+        } catch (const std::exception& e) {
+            // Instruction fetch failed: same PC, same fault, for every lane here.
+            credit(pending);
+            pending = 0;
+            for (std::size_t k = 0; k < lanes_; k++) {
+                if (!mask_[k]) continue;
+                states_[k] = LaneState::Fault;
+                faults_[k] = e.what();
+            }
+            rescan = true;
+            continue;
+        }
+
+        if (keeps_lanes_together(d->op)) {
+            // Fast path: straight-line code with all lanes together needs no
+            // per-lane bookkeeping, only the SIMD kernel itself.
+            execute(*d, sel);
+            ++pending;
+            sel = pcs_[first];
+            rescan = !converged || pending >= room;
+        } else {
+            credit(pending);
+            pending = 0;
+            execute(*d, sel);
+            credit(1); // lanes that faulted or stopped have left the mask
+            rescan = true;
+        }
+    }
+}
+
+void BatchEngine::execute(const DecodedInst& d, uint32_t pc) {
+    const batch::Kernels& kx = batch::best_kernels();
+    const std::size_t n = stride_;
+    uint32_t* const mask = mask_.data();
+    uint32_t* const rd  = &regs_[d.rd * stride_];
+    const uint32_t* const rs1 = &regs_[d.rs1 * stride_];
+    const uint32_t* const rs2 = &regs_[d.rs2 * stride_];
+    const uint32_t* const zero = &regs_[0];
+    const uint32_t imm = (uint32_t)d.imm;
+    const uint32_t next = pc + d.len;
+
+    auto for_lanes = [&](auto&& fn) {
+        for (std::size_t k = 0; k < lanes_; k++) {
+            if (!mask[k]) continue;
+            try {
+                fn(k);
+            } catch (const std::exception& e) {
+                states_[k] = LaneState::Fault;
+                faults_[k] = e.what();
+                mask[k] = 0; // don't advance or count it
+            }
+        }
+    };
+
+    auto advance = [&]() {
+        kx.branch(batch::CmpOp::Always, pcs_.data(), nullptr, nullptr, next, next, mask, n);
+    };
+
+    batch::AluOp aop;
+    batch::CmpOp cop;
+
+    switch (d.op) {
+        case Op::Add: case Op::Sub: case Op::And: case Op::Or: case Op::Xor:
+        case Op::Sll: case Op::Srl: case Op::Sra: case Op::Slt: case Op::Sltu:
+        case Op::Mul:
+            alu_op(d.op, aop);
+            if (d.rd != 0) kx.alu(aop, rd, rs1, rs2, 0, mask, n);
+            advance();
+            break;
+
+        case Op::Addi: case Op::Andi: case Op::Ori: case Op::Xori:
+        case Op::Slli: case Op::Srli: case Op::Srai: case Op::Slti: case Op::Sltiu:
+            alu_op(d.op, aop);
+            if (d.rd != 0) kx.alu(aop, rd, rs1, nullptr, imm, mask, n);
+            advance();
+            break;
+
+        case Op::Lui:
+            if (d.rd != 0) kx.alu(batch::AluOp::Add, rd, zero, nullptr, imm, mask, n);
+            advance();
+            break;
+
+        case Op::Auipc:
+            if (d.rd != 0) kx.alu(batch::AluOp::Add, rd, zero, nullptr, pc + imm, mask, n);
+            advance();
+            break;
+
+        case Op::Jal:
+            if (d.rd != 0) kx.alu(batch::AluOp::Add, rd, zero, nullptr, next, mask, n);
+            kx.branch(batch::CmpOp::Always, pcs_.data(), nullptr, nullptr, pc + imm, pc + imm, mask, n);
+            break;
+
+        case Op::Jalr:
+            for_lanes([&](std::size_t k) {
+                const uint32_t target = (rs1[k] + imm) & ~1u;
+                if (d.rd != 0) rd[k] = next;
+                pcs_[k] = target;
+            });
+            break;
+
+        case Op::Beq: case Op::Bne: case Op::Blt: case Op::Bge: case Op::Bltu: case Op::Bgeu:
+            branch_op(d.op, cop);
+            kx.branch(cop, pcs_.data(), rs1, rs2, pc + imm, next, mask, n);
+            break;
+
+        case Op::Lb: case Op::Lh: case Op::Lw: case Op::Lbu: case Op::Lhu:
+            for_lanes([&](std::size_t k) {
+                const uint32_t addr = rs1[k] + imm;
+                const Memory& m = *mems_[k];
+                uint32_t v = 0;
+                switch (d.op) {
+                    case Op::Lb:  v = (uint32_t)(int32_t)(int8_t)m.load8(addr); break;
+                    case Op::Lh:  v = (uint32_t)(int32_t)(int16_t)m.load16(addr); break;
+                    case Op::Lw:
+                        if (addr % 4 != 0) throw std::runtime_error("UNALIGNED_LW");
+                        v = m.load32(addr);
+                        break;
+                    case Op::Lbu: v = m.load8(addr); break;
+                    default:      v = m.load16(addr); break;
+                }
+                if (d.rd != 0) rd[k] = v;
+                pcs_[k] = next;
+            });
+            break;
+
+        case Op::Sb: case Op::Sh: case Op::Sw:
+            for_lanes([&](std::size_t k) {
+                const uint32_t addr = rs1[k] + imm;
+                Memory& m = *mems_[k];
+                if (d.op == Op::Sb) m.store8(addr, (uint8_t)rs2[k]);
+                else if (d.op == Op::Sh) m.store16(addr, (uint16_t)rs2[k]);
+                else {
+                    if (addr % 4 != 0) throw std::runtime_error("UNALIGNED_SW");
+                    m.store32(addr, rs2[k]);
+                }
+                pcs_[k] = next;
+            });
+            break;
+
+        case Op::Mulh: case Op::Mulhsu: case Op::Mulhu:
+        case Op::Div: case Op::Divu: case Op::Rem: case Op::Remu:
+            for_lanes([&](std::size_t k) {
+                const uint32_t v = muldiv(d.op, rs1[k], rs2[k]);
+                if (d.rd != 0) rd[k] = v;
+                pcs_[k] = next;
+            });
+            break;
+
+        case Op::Fence:
+        case Op::Wfi:
+            advance();
+            break;
+
+        case Op::FenceI:
+            advance();
+            dcache_.clear(); // d is dead after this
+            break;
+
+        case Op::Ecall:
+        case Op::Ebreak:
+            for (std::size_t k = 0; k < lanes_; k++) {
+                if (!mask[k]) continue;
+                states_[k] = (d.op == Op::Ecall) ? LaneState::Ecall : LaneState::Ebreak;
+                mask[k] = 0;
+            }
+            break;
+
+        case Op::Csrrw: case Op::Csrrs: case Op::Csrrc:
+        case Op::Csrrwi: case Op::Csrrsi: case Op::Csrrci:
+        case Op::Mret:
+            // CSR state is per hart; let the scalar CPU own it.
+            for (std::size_t k = 0; k < lanes_; k++) {
+                if (!mask[k]) continue;
+                mask[k] = 0;
+                peel(k, limit_ - instret_[k]);
+            }
+            break;
+
+        default:
+            for (std::size_t k = 0; k < lanes_; k++) {
+                if (!mask[k]) continue;
+                states_[k] = LaneState::Fault;
+                faults_[k] = "ILLEGAL";
+                mask[k] = 0;
+            }
+            break;
+    }
+
+}
+
+void BatchEngine::peel(std::size_t lane, uint64_t budget) {
+    CPU cpu(*mems_[lane]);
+    cpu.set_isa(isa_);
+    cpu.set_decode_cache_size(256);
+    cpu.reset(pcs_[lane]);
+    for (int r = 1; r < 32; r++) cpu.set_reg(r, reg(lane, r));
+
+    try {
+        cpu.run(budget);
+    } catch (const GuestStop& e) {
+        switch (e.reason()) {
+            case GuestStop::Reason::Ebreak: states_[lane] = LaneState::Ebreak; break;
+            case GuestStop::Reason::Ecall:  states_[lane] = LaneState::Ecall; break;
+        }
+    } catch (const std::exception& e) {
+        states_[lane] = LaneState::Fault;
+        faults_[lane] = e.what();
+    }
+
+    for (int r = 1; r < 32; r++) set_reg(lane, r, cpu.reg(r));
+    pcs_[lane] = cpu.pc();
+    instret_[lane] += cpu.instret();
+    ++peeled_;
+}
+
+} // namespace rv
@@ -0,0 +1,78 @@
+// Compiled with -mavx2; only reached after a runtime CPU check.
+#include "batch_kernels.hpp"
+
+#include <immintrin.h>
+
+namespace rv::batch {
+
+static inline __m256i blend256(__m256i mask, __m256i yes, __m256i no) {
+    return _mm256_blendv_epi8(no, yes, mask);
+}
+
+static void alu_avx2(AluOp op, uint32_t* dst, const uint32_t* a, const uint32_t* b,
+                     uint32_t imm, const uint32_t* mask, std::size_t n) {
+    const __m256i bias = _mm256_set1_epi32((int)0x80000000u);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i shmask = _mm256_set1_epi32(31);
+    const __m256i vimm = _mm256_set1_epi32((int)imm);
+
+    for (std::size_t k = 0; k < n; k += 8) {
+        __m256i m = _mm256_loadu_si256((const __m256i*)(mask + k));
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + k));
+        __m256i y = b ? _mm256_loadu_si256((const __m256i*)(b + k)) : vimm;
+        __m256i r;
+        switch (op) {
+            case AluOp::Add:  r = _mm256_add_epi32(x, y); break;
+            case AluOp::Sub:  r = _mm256_sub_epi32(x, y); break;
+            case AluOp::And:  r = _mm256_and_si256(x, y); break;
+            case AluOp::Or:   r = _mm256_or_si256(x, y); break;
+            case AluOp::Xor:  r = _mm256_xor_si256(x, y); break;
+            case AluOp::Sll:  r = _mm256_sllv_epi32(x, _mm256_and_si256(y, shmask)); break;
+            case AluOp::Srl:  r = _mm256_srlv_epi32(x, _mm256_and_si256(y, shmask)); break;
+            case AluOp::Sra:  r = _mm256_srav_epi32(x, _mm256_and_si256(y, shmask)); break;
+            case AluOp::Slt:  r = _mm256_and_si256(_mm256_cmpgt_epi32(y, x), one); break;
+            case AluOp::Sltu:
+                r = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_xor_si256(y, bias), _mm256_xor_si256(x, bias)), one);
+                break;
+            default: // Mul
+                r = _mm256_mullo_epi32(x, y);
+                break;
+        }
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + k));
+        _mm256_storeu_si256((__m256i*)(dst + k), blend256(m, r, d));
+    }
+}
+
+static void branch_avx2(CmpOp op, uint32_t* pc, const uint32_t* a, const uint32_t* b,
+                        uint32_t taken, uint32_t fallthrough, const uint32_t* mask, std::size_t n) {
+    const __m256i bias = _mm256_set1_epi32((int)0x80000000u);
+    const __m256i ones = _mm256_set1_epi32(-1);
+    const __m256i vt = _mm256_set1_epi32((int)taken);
+    const __m256i vf = _mm256_set1_epi32((int)fallthrough);
+
+    for (std::size_t k = 0; k < n; k += 8) {
+        __m256i m = _mm256_loadu_si256((const __m256i*)(mask + k));
+        __m256i c = ones;
+        if (op != CmpOp::Always) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(a + k));
+            __m256i y = _mm256_loadu_si256((const __m256i*)(b + k));
+            switch (op) {
+                case CmpOp::Eq:  c = _mm256_cmpeq_epi32(x, y); break;
+                case CmpOp::Ne:  c = _mm256_xor_si256(_mm256_cmpeq_epi32(x, y), ones); break;
+                case CmpOp::Lt:  c = _mm256_cmpgt_epi32(y, x); break;
+                case CmpOp::Ge:  c = _mm256_xor_si256(_mm256_cmpgt_epi32(y, x), ones); break;
+                case CmpOp::Ltu: c = _mm256_cmpgt_epi32(_mm256_xor_si256(y, bias), _mm256_xor_si256(x, bias)); break;
+                default:
+                    c = _mm256_xor_si256(_mm256_cmpgt_epi32(_mm256_xor_si256(y, bias), _mm256_xor_si256(x, bias)), ones);
+                    break;
+            }
+        }
+        __m256i target = blend256(c, vt, vf);
+        __m256i d = _mm256_loadu_si256((const __m256i*)(pc + k));
+        _mm256_storeu_si256((__m256i*)(pc + k), blend256(m, target, d));
+    }
+}
+
+const Kernels kAvx2Kernels = { alu_avx2, branch_avx2, "avx2" };
+
+} // namespace rv::batch
@@ -0,0 +1,160 @@
+#include "batch_kernels.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rv::batch {
+
+// ---- scalar reference ----
+
+static inline uint32_t alu1(AluOp op, uint32_t a, uint32_t b) {
+    switch (op) {
+        case AluOp::Add:  return a + b;
+        case AluOp::Sub:  return a - b;
+        case AluOp::And:  return a & b;
+        case AluOp::Or:   return a | b;
+        case AluOp::Xor:  return a ^ b;
+        case AluOp::Sll:  return a << (b & 31u);
+        case AluOp::Srl:  return a >> (b & 31u);
+        case AluOp::Sra:  return (uint32_t)((int32_t)a >> (b & 31u));
+        case AluOp::Slt:  return ((int32_t)a < (int32_t)b) ? 1u : 0u;
+        case AluOp::Sltu: return (a < b) ? 1u : 0u;
+        case AluOp::Mul:  return a * b;
+    }
+    return 0;
+}
+
+static inline bool cmp1(CmpOp op, uint32_t a, uint32_t b) {
+    switch (op) {
+        case CmpOp::Always: return true;
+        case CmpOp::Eq:  return a == b;
+        case CmpOp::Ne:  return a != b;
+        case CmpOp::Lt:  return (int32_t)a < (int32_t)b;
+        case CmpOp::Ge:  return (int32_t)a >= (int32_t)b;
+        case CmpOp::Ltu: return a < b;
+        case CmpOp::Geu: return a >= b;
+    }
+    return false;
+}
+
+static void alu_scalar(AluOp op, uint32_t* dst, const uint32_t* a, const uint32_t* b,
+                       uint32_t imm, const uint32_t* mask, std::size_t n) {
+    for (std::size_t k = 0; k < n; k++) {
+        if (mask[k]) dst[k] = alu1(op, a[k], b ? b[k] : imm);
+    }
+}
+
+static void branch_scalar(CmpOp op, uint32_t* pc, const uint32_t* a, const uint32_t* b,
+                          uint32_t taken, uint32_t fallthrough, const uint32_t* mask, std::size_t n) {
+    for (std::size_t k = 0; k < n; k++) {
+        if (!mask[k]) continue;
+        const bool t = (op == CmpOp::Always) || cmp1(op, a[k], b[k]); // a/b unused for Always
+        pc[k] = t ? taken : fallthrough;
+    }
+}
+
+const Kernels kScalarKernels = { alu_scalar, branch_scalar, "scalar" };
+
+// ---- SSE2 ----
+
+#if defined(__SSE2__)
+
+static inline __m128i blend128(__m128i mask, __m128i yes, __m128i no) {
+    return _mm_or_si128(_mm_and_si128(mask, yes), _mm_andnot_si128(mask, no));
+}
+
+static void alu_sse2(AluOp op, uint32_t* dst, const uint32_t* a, const uint32_t* b,
+                     uint32_t imm, const uint32_t* mask, std::size_t n) {
+    const bool shift = (op == AluOp::Sll || op == AluOp::Srl || op == AluOp::Sra);
+
+    if (shift && !b) {
+        // Uniform shift amount: the count-register forms handle it.
+        const __m128i sh = _mm_cvtsi32_si128((int)(imm & 31u));
+        for (std::size_t k = 0; k < n; k += 4) {
+            __m128i m = _mm_loadu_si128((const __m128i*)(mask + k));
+            __m128i x = _mm_loadu_si128((const __m128i*)(a + k));
+            __m128i r = (op == AluOp::Sll) ? _mm_sll_epi32(x, sh)
+                      : (op == AluOp::Srl) ? _mm_srl_epi32(x, sh)
+                                           : _mm_sra_epi32(x, sh);
+            __m128i d = _mm_loadu_si128((const __m128i*)(dst + k));
+            _mm_storeu_si128((__m128i*)(dst + k), blend128(m, r, d));
+        }
+        return;
+    }
+
+    // SSE2 has no per-lane variable shifts or 32-bit multiply.
+    if (shift || op == AluOp::Mul) {
+        alu_scalar(op, dst, a, b, imm, mask, n);
+        return;
+    }
+
+    const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i vimm = _mm_set1_epi32((int)imm);
+
+    for (std::size_t k = 0; k < n; k += 4) {
+        __m128i m = _mm_loadu_si128((const __m128i*)(mask + k));
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + k));
+        __m128i y = b ? _mm_loadu_si128((const __m128i*)(b + k)) : vimm;
+        __m128i r;
+        switch (op) {
+            case AluOp::Add: r = _mm_add_epi32(x, y); break;
+            case AluOp::Sub: r = _mm_sub_epi32(x, y); break;
+            case AluOp::And: r = _mm_and_si128(x, y); break;
+            case AluOp::Or:  r = _mm_or_si128(x, y); break;
+            case AluOp::Xor: r = _mm_xor_si128(x, y); break;
+            case AluOp::Slt: r = _mm_and_si128(_mm_cmplt_epi32(x, y), one); break;
+            default: // Sltu: flip the sign bits and compare signed
+                r = _mm_and_si128(_mm_cmplt_epi32(_mm_xor_si128(x, bias), _mm_xor_si128(y, bias)), one);
+                break;
+        }
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + k));
+        _mm_storeu_si128((__m128i*)(dst + k), blend128(m, r, d));
+    }
+}
+
+static void branch_sse2(CmpOp op, uint32_t* pc, const uint32_t* a, const uint32_t* b,
+                        uint32_t taken, uint32_t fallthrough, const uint32_t* mask, std::size_t n) {
+    const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i vt = _mm_set1_epi32((int)taken);
+    const __m128i vf = _mm_set1_epi32((int)fallthrough);
+
+    for (std::size_t k = 0; k < n; k += 4) {
+        __m128i m = _mm_loadu_si128((const __m128i*)(mask + k));
+        __m128i c = ones;
+        if (op != CmpOp::Always) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(a + k));
+            __m128i y = _mm_loadu_si128((const __m128i*)(b + k));
+            switch (op) {
+                case CmpOp::Eq:  c = _mm_cmpeq_epi32(x, y); break;
+                case CmpOp::Ne:  c = _mm_xor_si128(_mm_cmpeq_epi32(x, y), ones); break;
+                case CmpOp::Lt:  c = _mm_cmplt_epi32(x, y); break;
+                case CmpOp::Ge:  c = _mm_xor_si128(_mm_cmplt_epi32(x, y), ones); break;
+                case CmpOp::Ltu: c = _mm_cmplt_epi32(_mm_xor_si128(x, bias), _mm_xor_si128(y, bias)); break;
+                default:         c = _mm_xor_si128(_mm_cmplt_epi32(_mm_xor_si128(x, bias), _mm_xor_si128(y, bias)), ones); break;
+            }
+        }
+        __m128i target = blend128(c, vt, vf);
+        __m128i d = _mm_loadu_si128((const __m128i*)(pc + k));
+        _mm_storeu_si128((__m128i*)(pc + k), blend128(m, target, d));
+    }
+}
+
+const Kernels kSse2Kernels = { alu_sse2, branch_sse2, "sse2" };
+
+#endif // __SSE2__
+
+const Kernels& best_kernels() {
+#if defined(RV32I_HAVE_AVX2) && (defined(__GNUC__) || defined(__clang__))
+    if (__builtin_cpu_supports("avx2")) return kAvx2Kernels;
+#endif
+#if defined(__SSE2__)
+    return kSse2Kernels;
+#else
+    return kScalarKernels;
+#endif
+}
+
+} // namespace rv::batch
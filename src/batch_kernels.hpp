@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Lane-parallel kernels used by BatchEngine. All arrays hold n lanes, n is a
+// multiple of 8, and mask[k] is either 0 or ~0. Lanes with a zero mask are
+// left untouched. dst may alias a or b.
+
+namespace rv::batch {
+
+enum class AluOp : uint8_t { Add, Sub, And, Or, Xor, Sll, Srl, Sra, Slt, Sltu, Mul };
+enum class CmpOp : uint8_t { Always, Eq, Ne, Lt, Ge, Ltu, Geu };
+
+struct Kernels {
+    // dst[k] = op(a[k], b ? b[k] : imm)
+    void (*alu)(AluOp op, uint32_t* dst, const uint32_t* a, const uint32_t* b,
+                uint32_t imm, const uint32_t* mask, std::size_t n);
+
+    // pc[k] = cmp(a[k], b[k]) ? taken : fallthrough
+    void (*branch)(CmpOp op, uint32_t* pc, const uint32_t* a, const uint32_t* b,
+                   uint32_t taken, uint32_t fallthrough, const uint32_t* mask, std::size_t n);
+
+    const char* name;
+};
+
+extern const Kernels kScalarKernels;
+#if defined(__SSE2__)
+extern const Kernels kSse2Kernels;
+#endif
+#if defined(RV32I_HAVE_AVX2)
+extern const Kernels kAvx2Kernels;
+#endif
+
+// Widest kernel set the host CPU supports.
+const Kernels& best_kernels();
+
+} // namespace rv::batch
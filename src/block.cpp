@@ -0,0 +1,131 @@
+#include "rv/block.hpp"
+#include "rv/memory.hpp"
+#include "rv/replay.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rv {
+
+BlockDevice::BlockDevice(Memory& mem, const std::string& path, bool read_only)
+    : mem_(mem), read_only_(read_only) {
+    fd_ = ::open(path.c_str(), read_only ? O_RDONLY : O_RDWR);
+    if (fd_ < 0) throw std::runtime_error("Cannot open disk image: " + path);
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd_);
+        throw std::runtime_error("Disk image is not a regular file: " + path);
+    }
+    size_ = (std::size_t)st.st_size / kSectorSize * kSectorSize;
+    if (size_ == 0) return;
+
+    const int prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    void* p = ::mmap(nullptr, size_, prot, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        ::close(fd_);
+        throw std::runtime_error("Cannot map disk image: " + path);
+    }
+    map_ = static_cast<uint8_t*>(p);
+}
+
+BlockDevice::~BlockDevice() {
+    if (map_) ::munmap(map_, size_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+uint8_t* BlockDevice::window_byte(uint32_t offset) const {
+    const uint64_t at = (uint64_t)sector_ * kSectorSize + (offset - kWindow);
+    return at < size_ ? map_ + at : nullptr;
+}
+
+uint32_t BlockDevice::read(uint32_t offset, int size) {
+    if (offset >= kWindow && offset < kWindow + kSectorSize) {
+        uint32_t v = 0;
+        for (int i = 0; i < size; i++) {
+            const uint8_t* b = window_byte(offset + (uint32_t)i);
+            v |= (uint32_t)(b ? *b : 0) << (8 * i);
+        }
+        return v;
+    }
+
+    switch (offset) {
+        case kRegCapacity: return sectors() > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)sectors();
+        case kRegSector:   return sector_;
+        case kRegDmaAddr:  return dma_addr_;
+        case kRegDmaCount: return dma_count_;
+        case kRegStatus:   return status_;
+        default:           return 0;
+    }
+}
+
+void BlockDevice::write(uint32_t offset, uint32_t value, int size) {
+    InputLog* log = mem_.input_log();
+    const bool replaying = log && log->replaying();
+
+    if (offset >= kWindow && offset < kWindow + kSectorSize) {
+        if (read_only_ || replaying) return; // replay must leave the image alone
+        for (int i = 0; i < size; i++) {
+            if (uint8_t* b = window_byte(offset + (uint32_t)i)) *b = (uint8_t)(value >> (8 * i));
+        }
+        return;
+    }
+
+    switch (offset) {
+        case kRegSector:   sector_ = value; break;
+        case kRegDmaAddr:  dma_addr_ = value; break;
+        case kRegDmaCount: dma_count_ = value; break;
+        case kRegCmd:
+            if (replaying) status_ = replay_command(*log);
+            else {
+                status_ = execute(value);
+                if (log) log->value(InputLog::Kind::Device, status_);
+            }
+            break;
+        default:           break;
+    }
+}
+
+uint32_t BlockDevice::execute(uint32_t cmd) {
+    if (cmd == kCmdFlush) {
+        if (map_ && !read_only_ && ::msync(map_, size_, MS_SYNC) != 0) return kStatusError;
+        return kStatusOk;
+    }
+    if (cmd != kCmdRead && cmd != kCmdWrite) return kStatusError;
+    if (cmd == kCmdWrite && read_only_) return kStatusError;
+
+    const uint64_t off = (uint64_t)sector_ * kSectorSize;
+    const uint64_t n = (uint64_t)dma_count_ * kSectorSize;
+    if (off + n > size_) return kStatusError;
+
+    // Straight between the mapping and the RAM pages; a bad guest address
+    // fails the command instead of faulting the store that started it. A
+    // watchpoint must not stop the transfer halfway, so DMA ignores them.
+    SuspendWatchpoints guard(mem_);
+    try {
+        if (cmd == kCmdRead) mem_.write_block(dma_addr_, map_ + off, (std::size_t)n);
+        else mem_.read_block(dma_addr_, map_ + off, (std::size_t)n);
+    } catch (const std::out_of_range&) {
+        return kStatusError;
+    }
+    // The image is an input like any other: log what entered the guest.
+    if (cmd == kCmdRead) {
+        if (InputLog* log = mem_.input_log()) log->record_data(dma_addr_, map_ + off, (std::size_t)n);
+    }
+    return kStatusOk;
+}
+
+uint32_t BlockDevice::replay_command(InputLog& log) {
+    uint32_t addr = 0;
+    std::vector<uint8_t> data;
+    SuspendWatchpoints guard(mem_);
+    while (log.replay_data(addr, data)) mem_.write_block(addr, data.data(), data.size());
+    return log.value(InputLog::Kind::Device, 0);
+}
+
+} // namespace rv
@@ -0,0 +1,202 @@
+#include "rv/rv32i.h"
+
+#include "rv/cpu.hpp"
+#include "rv/device.hpp"
+#include "rv/isa.hpp"
+#include "rv/memory.hpp"
+#include "rv/syscall.hpp"
+
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Thrown from an ECALL callback that asked to stop.
+struct StopRequest {};
+
+class CallbackDevice : public rv::Device {
+public:
+    CallbackDevice(rv32i_mmio_read_fn rd, rv32i_mmio_write_fn wr, void* user)
+        : rd_(rd), wr_(wr), user_(user) {}
+
+    uint32_t read(uint32_t offset, int size) override {
+        return rd_ ? rd_(user_, offset, size) : 0;
+    }
+
+    void write(uint32_t offset, uint32_t value, int size) override {
+        if (wr_) wr_(user_, offset, value, size);
+    }
+
+private:
+    rv32i_mmio_read_fn rd_;
+    rv32i_mmio_write_fn wr_;
+    void* user_;
+};
+
+} // namespace
+
+struct rv32i_machine {
+    rv::Memory mem;
+    rv::CPU cpu;
+    std::unique_ptr<rv::Syscalls> sys;
+    std::vector<std::unique_ptr<CallbackDevice>> devices;
+    int exit_code = 0;
+    mutable std::string last_error;
+
+    rv32i_machine(uint32_t mem_size, const rv::Isa& isa) : mem(mem_size), cpu(mem) {
+        cpu.set_isa(isa);
+    }
+
+    rv32i_status fail(const std::exception& e) const {
+        last_error = e.what();
+        return RV32I_ERROR;
+    }
+};
+
+extern "C" {
+
+rv32i_machine* rv32i_create(uint32_t mem_size, const char* isa) {
+    try {
+        return new rv32i_machine(mem_size, rv::parse_isa(isa ? isa : "rv32i"));
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void rv32i_destroy(rv32i_machine* m) {
+    delete m;
+}
+
+rv32i_status rv32i_load_image(rv32i_machine* m, const void* data, size_t size, uint32_t base) {
+    try {
+        m->mem.write_block(base, data, size);
+        m->cpu.flush_decode_cache();
+        return RV32I_OK;
+    } catch (const std::exception& e) {
+        return m->fail(e);
+    }
+}
+
+rv32i_status rv32i_load_file(rv32i_machine* m, const char* path, uint32_t base) {
+    try {
+        m->mem.load_binary(path, base);
+        m->cpu.flush_decode_cache();
+        return RV32I_OK;
+    } catch (const std::exception& e) {
+        return m->fail(e);
+    }
+}
+
+void rv32i_reset(rv32i_machine* m, uint32_t pc) {
+    m->cpu.reset(pc);
+    m->exit_code = 0;
+}
+
+rv32i_status rv32i_run(rv32i_machine* m, uint64_t budget, uint64_t* executed) {
+    const uint64_t start = m->cpu.instret();
+    rv32i_status st = RV32I_OK;
+
+    try {
+        m->cpu.run(budget);
+    } catch (const rv::GuestExit& e) {
+        m->exit_code = e.code();
+        st = RV32I_EXITED;
+    } catch (const StopRequest&) {
+        st = RV32I_STOPPED;
+    } catch (const rv::GuestStop& e) {
+        switch (e.reason()) {
+            case rv::GuestStop::Reason::Ebreak: st = RV32I_EBREAK; break;
+            case rv::GuestStop::Reason::Ecall:  st = RV32I_ECALL; break;
+        }
+    } catch (const std::exception& e) {
+        st = m->fail(e);
+    } catch (...) {
+        m->last_error = "unknown exception";
+        st = RV32I_ERROR;
+    }
+
+    if (executed) *executed = m->cpu.instret() - start;
+    return st;
+}
+
+uint32_t rv32i_get_reg(const rv32i_machine* m, int reg) {
+    if (reg < 0 || reg > 31) return 0;
+    return m->cpu.reg(reg);
+}
+
+void rv32i_set_reg(rv32i_machine* m, int reg, uint32_t value) {
+    if (reg < 0 || reg > 31) return;
+    m->cpu.set_reg(reg, value);
+}
+
+uint32_t rv32i_get_pc(const rv32i_machine* m) {
+    return m->cpu.pc();
+}
+
+void rv32i_set_pc(rv32i_machine* m, uint32_t pc) {
+    m->cpu.set_pc(pc);
+}
+
+uint64_t rv32i_instret(const rv32i_machine* m) {
+    return m->cpu.instret();
+}
+
+rv32i_status rv32i_read_mem(const rv32i_machine* m, uint32_t addr, void* dst, size_t size) {
+    try {
+        m->mem.read_block(addr, dst, size);
+        return RV32I_OK;
+    } catch (const std::exception& e) {
+        return m->fail(e);
+    }
+}
+
+rv32i_status rv32i_write_mem(rv32i_machine* m, uint32_t addr, const void* src, size_t size) {
+    try {
+        m->mem.write_block(addr, src, size);
+        m->cpu.flush_decode_cache(); // the harness may be patching code
+        return RV32I_OK;
+    } catch (const std::exception& e) {
+        return m->fail(e);
+    }
+}
+
+void rv32i_enable_syscalls(rv32i_machine* m, uint32_t heap_base) {
+    m->sys = std::make_unique<rv::Syscalls>(m->mem);
+    m->sys->set_heap_base(heap_base);
+    m->sys->install(m->cpu);
+}
+
+void rv32i_set_ecall_handler(rv32i_machine* m, rv32i_ecall_fn fn, void* user) {
+    if (!fn) {
+        m->cpu.set_ecall_handler(nullptr);
+        return;
+    }
+    m->cpu.set_ecall_handler([m, fn, user](rv::CPU&) {
+        if (fn(m, user) != 0) throw StopRequest{};
+    });
+}
+
+rv32i_status rv32i_map_mmio(rv32i_machine* m, uint32_t base, uint32_t size,
+                            rv32i_mmio_read_fn read, rv32i_mmio_write_fn write, void* user) {
+    try {
+        auto dev = std::make_unique<CallbackDevice>(read, write, user);
+        m->mem.map_device(base, size, *dev);
+        m->devices.push_back(std::move(dev));
+        return RV32I_OK;
+    } catch (const std::exception& e) {
+        return m->fail(e);
+    }
+}
+
+int rv32i_exit_code(const rv32i_machine* m) {
+    return m->exit_code;
+}
+
+const char* rv32i_last_error(const rv32i_machine* m) {
+    return m->last_error.c_str();
+}
+
+} // extern "C"
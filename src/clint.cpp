@@ -0,0 +1,79 @@
+#include "rv/clint.hpp"
+#include "rv/cpu.hpp"
+
+namespace rv {
+
+Clint::Clint(CPU& cpu) : cpu_(cpu) {}
+
+void Clint::reset() {
+    mtimecmp_ = ~uint64_t{0};
+    offset_ = 0;
+    msip_ = false;
+    generation_++;
+    cpu_.clear_interrupt(CPU::kIrqSoftware);
+    cpu_.clear_interrupt(CPU::kIrqTimer);
+}
+
+uint64_t Clint::mtime() const {
+    return cpu_.instret() + offset_;
+}
+
+uint32_t Clint::read(uint32_t offset, int /*size*/) {
+    switch (offset) {
+        case kRegMsip:         return msip_ ? 1u : 0u;
+        case kRegMtimecmp:     return (uint32_t)mtimecmp_;
+        case kRegMtimecmp + 4: return (uint32_t)(mtimecmp_ >> 32);
+        case kRegMtime:        return (uint32_t)mtime();
+        case kRegMtime + 4:    return (uint32_t)(mtime() >> 32);
+        default:               return 0;
+    }
+}
+
+void Clint::write(uint32_t offset, uint32_t value, int /*size*/) {
+    switch (offset) {
+        case kRegMsip:
+            msip_ = value & 1u;
+            if (msip_) cpu_.raise_interrupt(CPU::kIrqSoftware);
+            else cpu_.clear_interrupt(CPU::kIrqSoftware);
+            break;
+        case kRegMtimecmp:
+            mtimecmp_ = (mtimecmp_ & 0xFFFFFFFF00000000ull) | value;
+            update_timer();
+            break;
+        case kRegMtimecmp + 4:
+            mtimecmp_ = (mtimecmp_ & 0xFFFFFFFFull) | ((uint64_t)value << 32);
+            update_timer();
+            break;
+        case kRegMtime:
+            set_mtime((mtime() & 0xFFFFFFFF00000000ull) | value);
+            break;
+        case kRegMtime + 4:
+            set_mtime((mtime() & 0xFFFFFFFFull) | ((uint64_t)value << 32));
+            break;
+        default:
+            break;
+    }
+}
+
+void Clint::set_mtime(uint64_t value) {
+    offset_ = value - cpu_.instret();
+    update_timer();
+}
+
+void Clint::update_timer() {
+    const uint64_t gen = ++generation_;
+
+    if (mtime() >= mtimecmp_) {
+        cpu_.raise_interrupt(CPU::kIrqTimer);
+        return;
+    }
+
+    // MTIP is level-triggered on mtime >= mtimecmp, so moving mtimecmp
+    // forward clears it until mtime catches up.
+    cpu_.clear_interrupt(CPU::kIrqTimer);
+    cpu_.schedule(mtimecmp_ - offset_, [this, gen] {
+        if (gen == generation_) update_timer();
+    });
+}
+
+} // namespace rv
@@ -0,0 +1,279 @@
+#include "rv/cosim.hpp"
+#include "rv/cpu.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rv {
+
+std::string format_commit(const CommitRecord& r) {
+    char buf[64];
+    if (r.rd != 0) {
+        std::snprintf(buf, sizeof(buf), "pc=0x%08x inst=0x%08x x%u=0x%08x", r.pc, r.inst, r.rd, r.value);
+    } else {
+        std::snprintf(buf, sizeof(buf), "pc=0x%08x inst=0x%08x", r.pc, r.inst);
+    }
+    return buf;
+}
+
+// ----------------------------------------------------------------------------
+// CommitLogWriter
+
+CommitLogWriter::CommitLogWriter(const std::string& path) {
+    if (path == "-") {
+        f_ = stdout;
+    } else {
+        f_ = std::fopen(path.c_str(), "wb");
+        if (!f_) throw std::runtime_error("Cannot open commit log: " + path);
+        owns_ = true;
+    }
+    buf_.reserve(kBufferRecords);
+    if (std::fwrite(kCommitLogMagic, sizeof(kCommitLogMagic), 1, f_) != 1) {
+        throw std::runtime_error("Cannot write commit log: " + path);
+    }
+}
+
+CommitLogWriter::~CommitLogWriter() {
+    flush();
+    if (owns_) std::fclose(f_);
+    else std::fflush(f_);
+}
+
+void CommitLogWriter::flush() {
+    if (!buf_.empty()) std::fwrite(buf_.data(), sizeof(CommitRecord), buf_.size(), f_);
+    buf_.clear();
+}
+
+// ----------------------------------------------------------------------------
+// CommitLogReader
+
+CommitLogReader::CommitLogReader(const std::string& path) {
+    if (path == "-") {
+        fd_ = 0;
+    } else {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) throw std::runtime_error("Cannot open commit log: " + path);
+        owns_fd_ = true;
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = ::mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p != MAP_FAILED) {
+            map_ = static_cast<const unsigned char*>(p);
+            map_size_ = (std::size_t)st.st_size;
+            ::madvise(p, map_size_, MADV_SEQUENTIAL);
+        }
+    }
+    if (!map_) buf_.resize(1 << 20);
+
+    char magic[sizeof(kCommitLogMagic)];
+    if (!read_exact(magic, sizeof(magic)) || std::memcmp(magic, kCommitLogMagic, sizeof(magic)) != 0) {
+        if (map_) ::munmap(const_cast<unsigned char*>(map_), map_size_);
+        if (owns_fd_) ::close(fd_);
+        throw std::runtime_error("Not a commit log: " + path);
+    }
+}
+
+CommitLogReader::~CommitLogReader() {
+    if (map_) ::munmap(const_cast<unsigned char*>(map_), map_size_);
+    map_ = nullptr;
+    if (owns_fd_ && fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
+
+bool CommitLogReader::next(CommitRecord& r) {
+    if (map_) {
+        if (map_size_ - map_pos_ < sizeof(r)) return false;
+        std::memcpy(&r, map_ + map_pos_, sizeof(r));
+        map_pos_ += sizeof(r);
+        return true;
+    }
+    return read_exact(&r, sizeof(r));
+}
+
+std::size_t CommitLogReader::read(CommitRecord* out, std::size_t n) {
+    if (map_) {
+        n = std::min(n, (map_size_ - map_pos_) / sizeof(CommitRecord));
+        std::memcpy(out, map_ + map_pos_, n * sizeof(CommitRecord));
+        map_pos_ += n * sizeof(CommitRecord);
+        return n;
+    }
+    return CommitSource::read(out, n);
+}
+
+bool CommitLogReader::read_exact(void* dst, std::size_t n) {
+    if (map_) {
+        if (map_size_ - map_pos_ < n) return false;
+        std::memcpy(dst, map_ + map_pos_, n);
+        map_pos_ += n;
+        return true;
+    }
+
+    auto* out = static_cast<unsigned char*>(dst);
+    while (n > 0) {
+        if (buf_pos_ == buf_len_) {
+            ssize_t got = ::read(fd_, buf_.data(), buf_.size());
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            buf_pos_ = 0;
+            buf_len_ = (std::size_t)got;
+        }
+        std::size_t take = std::min(n, buf_len_ - buf_pos_);
+        std::memcpy(out, buf_.data() + buf_pos_, take);
+        buf_pos_ += take;
+        out += take;
+        n -= take;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// CpuCommitSource
+
+CpuCommitSource::CpuCommitSource(CPU& ref) : cpu_(ref) {
+    cpu_.set_commit_sink(this);
+}
+
+CpuCommitSource::~CpuCommitSource() {
+    cpu_.set_commit_sink(nullptr);
+}
+
+bool CpuCommitSource::next(CommitRecord& r) {
+    if (ended_) return false;
+    got_ = false;
+    try {
+        cpu_.step();
+    } catch (...) {
+        ended_ = true;
+        return false;
+    }
+    // An interrupt taken at the boundary retires nothing before its first
+    // handler instruction, so step() always commits exactly one record.
+    if (!got_) return false;
+    r = last_;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// CosimChecker
+
+CosimChecker::CosimChecker(CommitSource& golden, std::size_t ring_records, std::size_t context)
+    : golden_(golden), context_(context) {
+    std::size_t n = 2 * kPublishEvery;
+    while (n < ring_records) n <<= 1;
+    ring_.resize(n);
+    mask_ = n - 1;
+
+    thread_ = std::thread([this] { check_loop(); });
+}
+
+CosimChecker::~CosimChecker() {
+    if (!finished_) finish();
+}
+
+void CosimChecker::publish() {
+    published_ = head_;
+    head_shared_.store(head_, std::memory_order_release);
+
+    // Make room for the records written before the next publish.
+    while (head_ + kPublishEvery - tail_cache_ > ring_.size()) {
+        if (diverged_.load(std::memory_order_acquire)) break;
+        std::this_thread::yield();
+        tail_cache_ = tail_shared_.load(std::memory_order_acquire);
+    }
+    if (diverged_.load(std::memory_order_acquire)) throw CosimDivergence(report_);
+}
+
+void CosimChecker::check_loop() {
+    // Golden records are fetched and compared in blocks; a block of matching
+    // records is one memcmp.
+    constexpr std::size_t kBlock = 1024;
+    std::vector<CommitRecord> expected(kBlock);
+    history_.resize(context_);
+    uint64_t tail = 0;
+
+    for (;;) {
+        const uint64_t head = head_shared_.load(std::memory_order_acquire);
+        if (tail == head) {
+            if (producer_done_.load(std::memory_order_acquire)) {
+                if (head_shared_.load(std::memory_order_acquire) != tail) continue;
+                CommitRecord extra;
+                if (golden_.next(extra)) diverge(&extra, nullptr);
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        while (tail != head) {
+            // Contiguous run of the ring, at most one block.
+            const std::size_t at = (std::size_t)(tail & mask_);
+            const std::size_t n = (std::size_t)std::min<uint64_t>({head - tail, ring_.size() - at, kBlock});
+            const CommitRecord* actual = &ring_[at];
+            const std::size_t got = golden_.read(expected.data(), n);
+
+            std::size_t same = 0;
+            if (got == n && std::memcmp(actual, expected.data(), n * sizeof(CommitRecord)) == 0) {
+                same = n;
+            } else {
+                while (same < got && actual[same] == expected[same]) same++;
+            }
+
+            remember(actual, same);
+            checked_.store(tail + same, std::memory_order_release);
+            if (same < n) {
+                diverge(same < got ? &expected[same] : nullptr, &actual[same]);
+                return;
+            }
+            tail += n;
+        }
+        tail_shared_.store(tail, std::memory_order_release);
+    }
+}
+
+void CosimChecker::remember(const CommitRecord* r, std::size_t n) {
+    if (context_ == 0) return;
+    for (std::size_t i = n > context_ ? n - context_ : 0; i < n; i++) {
+        history_[history_pos_++ % context_] = r[i];
+    }
+}
+
+void CosimChecker::diverge(const CommitRecord* expected, const CommitRecord* actual) {
+    const uint64_t n = checked_.load(std::memory_order_relaxed);
+
+    std::ostringstream os;
+    os << "cosim divergence at instruction " << n << "\n";
+    os << "  expected: " << (expected ? format_commit(*expected) : "<end of golden trace>") << "\n";
+    os << "  actual:   " << (actual ? format_commit(*actual) : "<simulation ended>") << "\n";
+
+    const std::size_t shown = std::min<std::size_t>(history_pos_, context_);
+    if (shown) {
+        os << "last " << shown << " matching instructions:\n";
+        for (std::size_t i = history_pos_ - shown; i < history_pos_; i++) {
+            os << "  " << format_commit(history_[i % context_]) << "\n";
+        }
+    }
+    report_ = os.str();
+    diverged_.store(true, std::memory_order_release);
+}
+
+bool CosimChecker::finish() {
+    if (!finished_) {
+        finished_ = true;
+        published_ = head_;
+        head_shared_.store(head_, std::memory_order_release);
+        producer_done_.store(true, std::memory_order_release);
+        thread_.join();
+    }
+    return !diverged();
+}
+
+} // namespace rv
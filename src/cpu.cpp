@@ -1,6 +1,10 @@
 
 #include "rv/cpu.hpp"
+#include "rv/cosim.hpp"
+#include "rv/debug.hpp"
 #include "rv/memory.hpp"
+#include <algorithm>
+#include <bit>
 #include <stdexcept>
 #include <iostream>
 #include <iomanip>
@@ -8,7 +12,31 @@
 
 namespace rv {
 
-CPU::CPU(Memory& mem) : mem_(mem) {
+namespace {
+
+constexpr uint32_t kCsrMstatus = 0x300;
+constexpr uint32_t kCsrMie     = 0x304;
+constexpr uint32_t kCsrMtvec   = 0x305;
+constexpr uint32_t kCsrMepc    = 0x341;
+constexpr uint32_t kCsrMcause  = 0x342;
+constexpr uint32_t kCsrMtval   = 0x343;
+constexpr uint32_t kCsrMip     = 0x344;
+
+constexpr uint32_t kMstatusMie  = 1u << 3;
+constexpr uint32_t kMstatusMpie = 1u << 7;
+constexpr uint32_t kMstatusMpp  = 3u << 11; // M-mode only: always reads 3
+
+// Synchronous exception causes (mcause with the interrupt bit clear).
+constexpr uint32_t kCauseMisalignedFetch = 0;
+constexpr uint32_t kCauseIllegal         = 2;
+constexpr uint32_t kCauseBreakpoint      = 3;
+constexpr uint32_t kCauseMisalignedLoad  = 4;
+constexpr uint32_t kCauseMisalignedStore = 6;
+constexpr uint32_t kCauseEcallM          = 11;
+
+} // namespace
+
+CPU::CPU(Memory& mem) : mem_(mem), trace_out_(&std::cout) {
     reset(0);
 }
 
@@ -16,560 +44,528 @@ void CPU::reset(uint32_t start_pc) {
     pc_ = start_pc;
     regs_.fill(0);
     regs_[0] = 0;
+    instret_ = 0;
 
-    csr_.fill(0);                 // ✅ clear CSRs
-         
+    csr_.clear();                 // ✅ clear CSRs
+    mstatus_ = mie_ = mip_ = mtvec_ = mepc_ = mcause_ = mtval_ = 0;
+    events_ = {};
+    stretch_end_ = 0;
+    stats_ = {};
+    resume_pending_ = false;
+    flush_decode_cache();
 }
 
-static inline uint32_t get_bits(uint32_t x, int hi, int lo) {
-    return (x >> lo) & ((1u << (hi - lo + 1)) - 1);
+void CPU::flush_decode_cache() {
+    for (auto& d : dcache_) d.pc = 0xFFFFFFFFu;
 }
 
-static inline int32_t sign_extend(uint32_t x, int bits) {
-    uint32_t m = 1u << (bits - 1);
-    return (int32_t)((x ^ m) - m);
+void CPU::set_decode_cache_size(std::size_t entries) {
+    if (entries == 0 || (entries & (entries - 1)) != 0) {
+        throw std::invalid_argument("decode cache size must be a power of two");
+    }
+    dcache_entries_ = entries;
+    dcache_.clear();
+    dcache_.shrink_to_fit();
 }
 
-static inline int32_t imm_b(uint32_t inst) {
-    // B-type: imm[12|10:5|4:1|11] from bits [31|30:25|11:8|7], LSB is 0
-    uint32_t imm =
-        (get_bits(inst, 31, 31) << 12) |
-        (get_bits(inst, 7, 7)   << 11) |
-        (get_bits(inst, 30, 25) << 5)  |
-        (get_bits(inst, 11, 8)  << 1);
-    return sign_extend(imm, 13);
-}
+const DecodedInst& CPU::fetch() {
+    if (dcache_.empty()) dcache_.resize(dcache_entries_);
 
-static inline int32_t imm_j(uint32_t inst) {
-    // J-type: imm[20|10:1|11|19:12] from bits [31|30:21|20|19:12], LSB is 0
-    uint32_t imm =
-        (get_bits(inst, 31, 31) << 20) |
-        (get_bits(inst, 19, 12) << 12) |
-        (get_bits(inst, 20, 20) << 11) |
-        (get_bits(inst, 30, 21) << 1);
-    return sign_extend(imm, 21);
+    // PCs are at least 2-byte aligned, so drop bit 0 from the index.
+    DecodedInst& d = dcache_[(pc_ >> 1) & (dcache_entries_ - 1)];
+    if (d.pc != pc_) fill(d);
+    return d;
 }
 
-void CPU::step() {
-    uint32_t inst = mem_.load32(pc_);
-
-    uint32_t opcode = get_bits(inst, 6, 0);
-    uint32_t rd     = get_bits(inst, 11, 7);
-    uint32_t funct3 = get_bits(inst, 14, 12);
-    uint32_t rs1    = get_bits(inst, 19, 15);
-    uint32_t rs2    = get_bits(inst, 24, 20);
-    uint32_t funct7 = get_bits(inst, 31, 25);
-
-    uint32_t next_pc = pc_ + 4;
-
-    // For trace
-    const uint32_t pc_before = pc_;
-    const uint32_t inst_before = inst;
-    const char* mnemonic = "unknown";
-    int wb_reg = -1;
-    uint32_t wb_val = 0;
-    int32_t imm_for_print = 0; // only used for addi trace
-
-    if (inst == 0x00100073) { // EBREAK
-      mnemonic = "ebreak";
-     if (trace_) {
-    std::cout << "PC=0x" << std::hex << std::setw(8) << std::setfill('0') << pc_before
-     << " INST=0x" << std::setw(8) << inst_before
-     << " " << mnemonic << std::dec << "\n";
-}
-     throw std::runtime_error("EBREAK");
-}
-    else if (inst == 0x00000073) { // ECALL
-    // Trap handling intentionally not supported.
-    // Treat ECALL as a clean stop, similar to EBREAK.
-    mnemonic = "ecall";
-    if (trace_) {
-        std::cout << "PC=0x" << std::hex << std::setw(8) << std::setfill('0') << pc_before
-                  << " INST=0x" << std::setw(8) << inst_before
-                  << " " << mnemonic << std::dec << "\n";
+void CPU::fill(DecodedInst& d) {
+    d = decode_at(pc_);
+    if (!breakpoints_.empty() && std::binary_search(breakpoints_.begin(), breakpoints_.end(), pc_)) {
+        d.op = Op::Breakpoint;
     }
-    throw std::runtime_error("ECALL");
 }
-    
 
-   else if (opcode == 0x73 && funct3 != 0x0) {
-    // CSR instructions (CSRRW/CSRRS/CSRRC + immediate forms)
-    uint32_t csr_addr = get_bits(inst, 31, 20);
-    uint32_t old = csr_read(csr_addr);
-
-    bool imm_form = (funct3 & 0x4u) != 0;     // 101/110/111
-    uint32_t src  = imm_form ? rs1 : regs_[rs1]; // rs1 is zimm for imm forms
-
-    uint32_t newv = old;
-    bool do_write = true;
-
-    switch (funct3) {
-        case 0x1: // CSRRW
-            mnemonic = "csrrw";
-            newv = src;
-            break;
-
-        case 0x2: // CSRRS
-            mnemonic = "csrrs";
-            if (src == 0) do_write = false;
-            newv = old | src;
-            break;
-
-        case 0x3: // CSRRC
-            mnemonic = "csrrc";
-            if (src == 0) do_write = false;
-            newv = old & ~src;
-            break;
-
-        case 0x5: // CSRRWI
-            mnemonic = "csrrwi";
-            newv = src & 0x1Fu;
-            break;
+DecodedInst CPU::decode_at(uint32_t pc) {
+    SuspendWatchpoints guard(mem_);
+    return fetch_decode(mem_, pc, isa_);
+}
 
-        case 0x6: // CSRRSI
-            mnemonic = "csrrsi";
-            if ((src & 0x1Fu) == 0) do_write = false;
-            newv = old | (src & 0x1Fu);
-            break;
+void CPU::invalidate(uint32_t pc) {
+    if (dcache_.empty()) return;
+    DecodedInst& d = dcache_[(pc >> 1) & (dcache_entries_ - 1)];
+    if (d.pc == pc) d.pc = 0xFFFFFFFFu;
+}
 
-        case 0x7: // CSRRCI
-            mnemonic = "csrrci";
-            if ((src & 0x1Fu) == 0) do_write = false;
-            newv = old & ~(src & 0x1Fu);
-            break;
+void CPU::add_breakpoint(uint32_t pc) {
+    auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(), pc);
+    if (it != breakpoints_.end() && *it == pc) return;
+    breakpoints_.insert(it, pc);
+    invalidate(pc);
+}
 
-       default:
-    throw std::runtime_error("ILLEGAL_CSR");
-    }
+void CPU::remove_breakpoint(uint32_t pc) {
+    auto it = std::lower_bound(breakpoints_.begin(), breakpoints_.end(), pc);
+    if (it == breakpoints_.end() || *it != pc) return;
+    breakpoints_.erase(it);
+    invalidate(pc);
+}
 
-    // rd gets OLD CSR value
-    if (rd != 0) {
-        regs_[rd] = old;
-        wb_reg = (int)rd;
-        wb_val = old;
-    }
+void CPU::clear_breakpoints() {
+    breakpoints_.clear();
+    flush_decode_cache();
+}
 
-    if (do_write) {
-        csr_write(csr_addr, newv);
+void CPU::step_over() {
+    SuspendWatchpoints guard(mem_);
+    stepping_over_ = true;
+    try {
+        execute(fetch());
+    } catch (...) {
+        stepping_over_ = false;
+        throw;
     }
+    stepping_over_ = false;
 }
 
-
-    else if (opcode == 0x0F) {
-    // FENCE / FENCE.I  (treat as NOP)
-    mnemonic = (funct3 == 0x1) ? "fence.i" : "fence";
-    // do nothing, just fall through with next_pc = pc_ + 4
+void CPU::step() {
+    run(1);
 }
-   
-    else if (opcode == 0x13) {
-    // I-type ALU (ADDI, ANDI, ORI, XORI, SLTI, SLTIU, SLLI, SRLI, SRAI)
-    int32_t imm = sign_extend(get_bits(inst, 31, 20), 12);
-    imm_for_print = imm;
 
-    uint32_t a = regs_[rs1];
-    uint32_t val = 0;
-
-    switch (funct3) {
-        case 0x0: // ADDI
-            mnemonic = "addi";
-            val = a + (uint32_t)imm;
-            break;
+void CPU::execute(const DecodedInst& d) {
+    const uint32_t rd  = d.rd;
+    const uint32_t rs1 = d.rs1;
+    const uint32_t rs2 = d.rs2;
+    const uint32_t a = regs_[rs1];
+    const uint32_t b = regs_[rs2];
+    const uint32_t imm = (uint32_t)d.imm;
 
-        case 0x7: // ANDI
-            mnemonic = "andi";
-            val = a & (uint32_t)imm;
-            break;
+    uint32_t next_pc = pc_ + d.len;
 
-        case 0x6: // ORI
-            mnemonic = "ori";
-            val = a | (uint32_t)imm;
-            break;
-
-        case 0x4: // XORI
-            mnemonic = "xori";
-            val = a ^ (uint32_t)imm;
-            break;
+    // For trace
+    int wb_reg = -1;
+    uint32_t wb_val = 0;
 
-        case 0x2: // SLTI (signed)
-            mnemonic = "slti";
-            val = ((int32_t)a < imm) ? 1u : 0u;
+    // Value written back to rd; ops without a destination clear writes_rd.
+    bool writes_rd = true;
+    uint32_t val = 0;
+    bool taken = false; // conditional branches only
+    bool fence_i = false;
+
+    switch (d.op) {
+        case Op::Lui:   val = imm; break;
+        case Op::Auipc: val = pc_ + imm; break;
+
+        case Op::Jal:
+            val = pc_ + d.len;
+            next_pc = pc_ + imm;
+            if ((next_pc & 2u) && !isa_.c) raise(kCauseMisalignedFetch, next_pc, "MISALIGNED_FETCH");
+            break;
+
+        case Op::Jalr:
+            val = pc_ + d.len;
+            next_pc = (a + imm) & ~1u;
+            if ((next_pc & 2u) && !isa_.c) raise(kCauseMisalignedFetch, next_pc, "MISALIGNED_FETCH");
             break;
 
-        case 0x3: // SLTIU (unsigned)
-            mnemonic = "sltiu";
-            val = (a < (uint32_t)imm) ? 1u : 0u;
-            break;
+        // Branches
+        case Op::Beq:  writes_rd = false; taken = (a == b); break;
+        case Op::Bne:  writes_rd = false; taken = (a != b); break;
+        case Op::Blt:  writes_rd = false; taken = ((int32_t)a <  (int32_t)b); break;
+        case Op::Bge:  writes_rd = false; taken = ((int32_t)a >= (int32_t)b); break;
+        case Op::Bltu: writes_rd = false; taken = (a <  b); break;
+        case Op::Bgeu: writes_rd = false; taken = (a >= b); break;
 
-        case 0x1: { // SLLI (shamt in [24:20], funct7 must be 0)
-            if (funct7 != 0x00) throw std::runtime_error("ILLEGAL_SLLI");
-            mnemonic = "slli";
-            uint32_t shamt = get_bits(inst, 24, 20) & 31u;
-            val = a << shamt;
-            imm_for_print = (int32_t)shamt; // nicer trace
-            break;
+        // Loads
+        case Op::Lb:  val = (uint32_t)(int32_t)(int8_t)mem_.load8(a + imm); break;
+        case Op::Lh:
+            if ((a + imm) % 2 != 0) raise(kCauseMisalignedLoad, a + imm, "UNALIGNED_LH");
+            val = (uint32_t)(int32_t)(int16_t)mem_.load16(a + imm);
+            break;
+        case Op::Lw:
+            if ((a + imm) % 4 != 0) raise(kCauseMisalignedLoad, a + imm, "UNALIGNED_LW");
+            val = mem_.load32(a + imm);
+            break;
+        case Op::Lbu: val = mem_.load8(a + imm); break;
+        case Op::Lhu:
+            if ((a + imm) % 2 != 0) raise(kCauseMisalignedLoad, a + imm, "UNALIGNED_LH");
+            val = mem_.load16(a + imm);
+            break;
+
+        // Stores
+        case Op::Sb: writes_rd = false; mem_.store8(a + imm, (uint8_t)(b & 0xFF)); break;
+        case Op::Sh:
+            writes_rd = false;
+            if ((a + imm) % 2 != 0) raise(kCauseMisalignedStore, a + imm, "UNALIGNED_SH");
+            mem_.store16(a + imm, (uint16_t)(b & 0xFFFF));
+            break;
+        case Op::Sw:
+            writes_rd = false;
+            if ((a + imm) % 4 != 0) raise(kCauseMisalignedStore, a + imm, "UNALIGNED_SW");
+            mem_.store32(a + imm, b);
+            break;
+
+        // I-type ALU
+        case Op::Addi:  val = a + imm; break;
+        case Op::Slti:  val = ((int32_t)a < (int32_t)imm) ? 1u : 0u; break;
+        case Op::Sltiu: val = (a < imm) ? 1u : 0u; break;
+        case Op::Xori:  val = a ^ imm; break;
+        case Op::Ori:   val = a | imm; break;
+        case Op::Andi:  val = a & imm; break;
+        case Op::Slli:  val = a << (imm & 31u); break;
+        case Op::Srli:  val = a >> (imm & 31u); break;
+        case Op::Srai:  val = (uint32_t)((int32_t)a >> (imm & 31u)); break;
+
+        // R-type ALU
+        case Op::Add:  val = a + b; break;
+        case Op::Sub:  val = a - b; break;
+        case Op::Sll:  val = a << (b & 31u); break;
+        case Op::Slt:  val = ((int32_t)a < (int32_t)b) ? 1u : 0u; break;
+        case Op::Sltu: val = (a < b) ? 1u : 0u; break;
+        case Op::Xor:  val = a ^ b; break;
+        case Op::Srl:  val = a >> (b & 31u); break;
+        case Op::Sra:  val = (uint32_t)((int32_t)a >> (b & 31u)); break;
+        case Op::Or:   val = a | b; break;
+        case Op::And:  val = a & b; break;
+
+        // RV32M
+        case Op::Mul:    val = a * b; break;
+        case Op::Mulh:   val = (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32); break;
+        case Op::Mulhsu: val = (uint32_t)(((int64_t)(int32_t)a * (int64_t)(uint64_t)b) >> 32); break;
+        case Op::Mulhu:  val = (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32); break;
+
+        case Op::Div: // x/0 = -1, INT_MIN/-1 = INT_MIN
+            if (b == 0) val = 0xFFFFFFFFu;
+            else if (a == 0x80000000u && b == 0xFFFFFFFFu) val = a;
+            else val = (uint32_t)((int32_t)a / (int32_t)b);
+            break;
+
+        case Op::Divu: // x/0 = 2^32-1
+            val = (b == 0) ? 0xFFFFFFFFu : a / b;
+            break;
+
+        case Op::Rem: // x%0 = x, INT_MIN%-1 = 0
+            if (b == 0) val = a;
+            else if (a == 0x80000000u && b == 0xFFFFFFFFu) val = 0;
+            else val = (uint32_t)((int32_t)a % (int32_t)b);
+            break;
+
+        case Op::Remu: // x%0 = x
+            val = (b == 0) ? a : a % b;
+            break;
+
+        case Op::Fence:
+            // treat as NOP
+            writes_rd = false;
+            break;
+
+        case Op::FenceI:
+            // Instruction memory may have changed: drop everything decoded,
+            // once d (which lives in the cache) has been traced and retired.
+            writes_rd = false;
+            fence_i = true;
+            break;
+
+        case Op::Ecall:
+            // Without a handler, ECALL is a clean stop similar to EBREAK,
+            // unless exceptions are trapped.
+            writes_rd = false;
+            if (trace_) print_trace(d, -1, 0);
+            if (!ecall_handler_) raise(kCauseEcallM, 0, "ECALL");
+            ecall_handler_(*this);
+            break;
+
+        case Op::Ebreak:
+            if (trace_) print_trace(d, -1, 0);
+            raise(kCauseBreakpoint, pc_, "EBREAK");
+
+        case Op::Mret:
+            writes_rd = false;
+            next_pc = mepc_;
+            mstatus_ = (mstatus_ & kMstatusMpie) ? (mstatus_ | kMstatusMie) : (mstatus_ & ~kMstatusMie);
+            mstatus_ |= kMstatusMpie;
+            end_stretch(); // interrupts may be enabled again
+            break;
+
+        case Op::Breakpoint: {
+            if (!stepping_over_) throw DebugStop(DebugStop::Kind::Breakpoint, pc_);
+            // Resuming: run the real instruction, which retires on its own.
+            const DecodedInst real = decode_at(pc_);
+            execute(real);
+            return;
         }
 
-        case 0x5: { // SRLI/SRAI
-            uint32_t shamt = get_bits(inst, 24, 20) & 31u;
-            if (funct7 == 0x00) {
-                mnemonic = "srli";
-                val = a >> shamt;
-            } else if (funct7 == 0x20) {
-                mnemonic = "srai";
-                val = (uint32_t)((int32_t)a >> shamt);
-            } else {
-                throw std::runtime_error("ILLEGAL_SRLI_SRAI");
+        case Op::Wfi:
+            // Legal to implement as a NOP; the guest loops until its
+            // interrupt arrives at the next stretch boundary.
+            writes_rd = false;
+            break;
+
+        case Op::Csrrw:
+        case Op::Csrrs:
+        case Op::Csrrc:
+        case Op::Csrrwi:
+        case Op::Csrrsi:
+        case Op::Csrrci: {
+            const uint32_t csr_addr = imm;
+            const uint32_t old = csr_read(csr_addr);
+
+            // rs1 is zimm for the immediate forms
+            const bool imm_form = d.op >= Op::Csrrwi;
+            const uint32_t src = imm_form ? (rs1 & 0x1Fu) : a;
+
+            // CSRRS/CSRRC (and immediate forms) don't write when src is x0/0
+            if (d.op == Op::Csrrw || d.op == Op::Csrrwi) csr_write(csr_addr, src);
+            else if (rs1 != 0) {
+                if (d.op == Op::Csrrs || d.op == Op::Csrrsi) csr_write(csr_addr, old | src);
+                else csr_write(csr_addr, old & ~src);
             }
-            imm_for_print = (int32_t)shamt; // nicer trace
+
+            // rd gets OLD CSR value
+            val = old;
             break;
         }
 
         default:
-            throw std::runtime_error("ILLEGAL_ITYPE_ALU");
+            if (trace_) print_trace(d, -1, 0);
+            raise(kCauseIllegal, d.raw, "ILLEGAL");
+    }
+
+    if (taken) {
+        next_pc = pc_ + imm;
+        if ((next_pc & 2u) && !isa_.c) raise(kCauseMisalignedFetch, next_pc, "MISALIGNED_FETCH");
+        ++stats_.branches_taken;
     }
 
-    if (rd != 0) {
+    if (writes_rd && rd != 0) {
         regs_[rd] = val;
         wb_reg = (int)rd;
         wb_val = val;
     }
-}
-
-else if (opcode == 0x03) {
-    // Loads: LB/LH/LW/LBU/LHU
-    int32_t imm = sign_extend(get_bits(inst, 31, 20), 12);
-    imm_for_print = imm;
-    uint32_t addr = regs_[rs1] + (uint32_t)imm;
-
-    uint32_t val = 0;
 
-    switch (funct3) {
-        case 0x0: { // LB
-            mnemonic = "lb";
-            int8_t b = (int8_t)mem_.load8(addr);
-            val = (uint32_t)(int32_t)b; // sign-extend
-            break;
-        }
-        case 0x1: { // LH
-            mnemonic = "lh";
-            int16_t h = (int16_t)mem_.load16(addr);
-            val = (uint32_t)(int32_t)h; // sign-extend
-            break;
-        }
-        case 0x2: { // LW
-            mnemonic = "lw";
-            if (addr % 4 != 0) throw std::runtime_error("UNALIGNED_LW");
-            val = mem_.load32(addr);
-            break;
-        }
-        case 0x4: { // LBU
-            mnemonic = "lbu";
-            uint8_t b = mem_.load8(addr);
-            val = (uint32_t)b; // zero-extend
-            break;
-        }
-        case 0x5: { // LHU
-            mnemonic = "lhu";
-            uint16_t h = mem_.load16(addr);
-            val = (uint32_t)h; // zero-extend
-            break;
-        }
-        default:
-            throw std::runtime_error("ILLEGAL_LOAD");
+    // Print trace AFTER execution (so WB values are final). ECALL was
+    // printed before its handler ran.
+    if (trace_ && d.op != Op::Ecall) print_trace(d, wb_reg, wb_val);
+    if (commit_sink_) {
+        commit_sink_->commit(CommitRecord{pc_, d.raw, wb_reg < 0 ? 0u : (uint32_t)wb_reg, wb_val});
     }
 
-    if (rd != 0) {
-        regs_[rd] = val;
-        wb_reg = (int)rd;
-        wb_val = val;
-    }
+    regs_[0] = 0;
+    pc_ = next_pc;
+    ++stats_.retired[(std::size_t)d.op];
+    ++instret_;
+    if (fence_i) flush_decode_cache();
 }
 
-else if (opcode == 0x23) {
-    // Stores: SB/SH/SW (S-type)
-    uint32_t imm11_5 = get_bits(inst, 31, 25);
-    uint32_t imm4_0  = get_bits(inst, 11, 7);
-    int32_t imm = sign_extend((imm11_5 << 5) | imm4_0, 12);
-    imm_for_print = imm;
+void CPU::run(uint64_t max_instructions) {
+    const uint64_t end = (max_instructions > ~uint64_t{0} - instret_)
+                             ? ~uint64_t{0}
+                             : instret_ + max_instructions;
 
-    uint32_t addr = regs_[rs1] + (uint32_t)imm;
+    bool step_over_first = resume_pending_ && pc_ == resume_pc_;
+    resume_pending_ = false;
 
-    switch (funct3) {
-        case 0x0: // SB
-            mnemonic = "sb";
-            mem_.store8(addr, (uint8_t)(regs_[rs2] & 0xFF));
-            break;
+    try {
+        while (instret_ < end) {
+            try {
+                if (step_over_first) {
+                    step_over_first = false;
+                    step_over();
+                    continue;
+                }
 
-        case 0x1: // SH
-            mnemonic = "sh";
-            mem_.store16(addr, (uint16_t)(regs_[rs2] & 0xFFFF));
-            break;
+                service_events();
+                take_interrupt();
 
-        case 0x2: // SW
-            mnemonic = "sw";
-            if (addr % 4 != 0) throw std::runtime_error("UNALIGNED_SW");
-            mem_.store32(addr, regs_[rs2]);
-            break;
+                stretch_end_ = end;
+                if (!events_.empty() && events_.top().when < stretch_end_) stretch_end_ = events_.top().when;
 
-        default:
-            throw std::runtime_error("ILLEGAL_STORE");
+                while (instret_ < stretch_end_) execute(fetch());
+            } catch (const TrapEntered&) {
+                // pc_ is at the handler; the stretch goes on from there.
+            }
+        }
+    } catch (const DebugStop&) {
+        resume_pending_ = true;
+        resume_pc_ = pc_;
+        throw;
     }
 }
 
-else if (opcode == 0x6F) {
-    // JAL
-    mnemonic = "jal";
-    int32_t imm = imm_j(inst);
-    imm_for_print = imm;
-
-    uint32_t ret = pc_ + 4;
-    uint32_t target = pc_ + (uint32_t)imm;
+void CPU::schedule(uint64_t when, Event fn) {
+    events_.push(PendingEvent{when, event_seq_++, std::move(fn)});
+    if (when < stretch_end_) stretch_end_ = std::max(when, instret_ + 1);
+}
 
-    if (rd != 0) {
-        regs_[rd] = ret;
-        wb_reg = (int)rd;
-        wb_val = ret;
+void CPU::service_events() {
+    // Handlers may schedule more events, including ones already due.
+    while (!events_.empty() && events_.top().when <= instret_) {
+        Event fn = events_.top().fn;
+        events_.pop();
+        fn();
     }
+}
 
-    next_pc = target;
+void CPU::raise_interrupt(uint32_t irq) {
+    mip_ |= 1u << irq;
+    end_stretch();
 }
 
-else if (opcode == 0x67 && funct3 == 0x0) {
-    // JALR
-    mnemonic = "jalr";
-    int32_t imm = sign_extend(get_bits(inst, 31, 20), 12);
-    imm_for_print = imm;
+void CPU::clear_interrupt(uint32_t irq) {
+    mip_ &= ~(1u << irq);
+}
 
-    uint32_t ret = pc_ + 4;
-    uint32_t target = (regs_[rs1] + (uint32_t)imm) & ~1u;
+void CPU::take_interrupt() {
+    const uint32_t pending = mip_ & mie_;
+    if (pending == 0 || !(mstatus_ & kMstatusMie)) return;
 
-    if (rd != 0) {
-        regs_[rd] = ret;
-        wb_reg = (int)rd;
-        wb_val = ret;
-    }
+    // Fixed priority: external, software, timer, then anything else.
+    uint32_t cause;
+    if (pending & (1u << kIrqExternal)) cause = kIrqExternal;
+    else if (pending & (1u << kIrqSoftware)) cause = kIrqSoftware;
+    else if (pending & (1u << kIrqTimer)) cause = kIrqTimer;
+    else cause = (uint32_t)std::countr_zero(pending);
 
-    next_pc = target;
+    ++stats_.interrupts;
+    const uint32_t base = mtvec_ & ~3u;
+    enter_trap(0x80000000u | cause, (mtvec_ & 1u) ? base + 4 * cause : base);
 }
 
-else if (opcode == 0x37) {
-    // LUI
-    mnemonic = "lui";
-    uint32_t imm = inst & 0xFFFFF000u;   // upper 20 bits << 12
-    imm_for_print = (int32_t)imm;
-
-    if (rd != 0) {
-        regs_[rd] = imm;
-        wb_reg = (int)rd;
-        wb_val = imm;
+void CPU::raise(uint32_t cause, uint32_t tval, const char* stop) {
+    // Exceptions always go to the mtvec base, even in vectored mode.
+    const uint32_t handler = mtvec_ & ~3u;
+    if (!trap_exceptions_ || handler == pc_) {
+        if (cause == kCauseBreakpoint) throw GuestStop(GuestStop::Reason::Ebreak);
+        if (cause == kCauseEcallM) throw GuestStop(GuestStop::Reason::Ecall);
+        throw std::runtime_error(stop);
     }
+
+    ++stats_.exceptions;
+    mtval_ = tval;
+    enter_trap(cause, handler);
+    throw TrapEntered{};
 }
 
-else if (opcode == 0x17) {
-    // AUIPC
-    mnemonic = "auipc";
-    uint32_t imm = inst & 0xFFFFF000u;
-    imm_for_print = (int32_t)imm;
+void CPU::enter_trap(uint32_t cause, uint32_t handler) {
+    mepc_ = pc_;
+    mcause_ = cause;
+    mstatus_ = (mstatus_ & kMstatusMie) ? (mstatus_ | kMstatusMpie) : (mstatus_ & ~kMstatusMpie);
+    mstatus_ &= ~kMstatusMie;
 
-    uint32_t val = pc_ + imm;
-    if (rd != 0) {
-        regs_[rd] = val;
-        wb_reg = (int)rd;
-        wb_val = val;
+    if (trace_) {
+        *trace_out_ << "PC=0x" << std::hex << std::setw(8) << std::setfill('0') << pc_
+                  << ((cause & 0x80000000u) ? " INTERRUPT" : " EXCEPTION")
+                  << " cause=" << std::dec << (cause & 0x7FFFFFFFu)
+                  << " -> 0x" << std::hex << std::setw(8) << handler << std::dec << "\n";
     }
+    pc_ = handler;
 }
 
-else if (opcode == 0x63) {
-    // Branches (B-type)
-    int32_t off = imm_b(inst);
-    imm_for_print = off;
+void CPU::print_trace(const DecodedInst& d, int wb_reg, uint32_t wb_val) const {
+    std::ostream& out = *trace_out_;
+    out << "PC=0x" << std::hex << std::setw(8) << std::setfill('0') << d.pc
+              << " INST=0x" << std::setw(8) << d.raw
+              << " " << op_name(d.op) << std::dec;
 
-    bool take = false;
+    const unsigned rd = d.rd, rs1 = d.rs1, rs2 = d.rs2;
 
-    switch (funct3) {
-        case 0x0: // BEQ
-            mnemonic = "beq";
-            take = (regs_[rs1] == regs_[rs2]);
-            break;
-        case 0x1: // BNE
-            mnemonic = "bne";
-            take = (regs_[rs1] != regs_[rs2]);
-            break;
-        case 0x4: // BLT (signed)
-            mnemonic = "blt";
-            take = ((int32_t)regs_[rs1] < (int32_t)regs_[rs2]);
-            break;
-        case 0x5: // BGE (signed)
-            mnemonic = "bge";
-            take = ((int32_t)regs_[rs1] >= (int32_t)regs_[rs2]);
-            break;
-        case 0x6: // BLTU (unsigned)
-            mnemonic = "bltu";
-            take = (regs_[rs1] < regs_[rs2]);
+    switch (d.op) {
+        case Op::Addi: case Op::Slti: case Op::Sltiu: case Op::Xori:
+        case Op::Ori: case Op::Andi: case Op::Slli: case Op::Srli: case Op::Srai:
+            out << " x" << rd << ",x" << rs1 << "," << d.imm;
             break;
-        case 0x7: // BGEU (unsigned)
-            mnemonic = "bgeu";
-            take = (regs_[rs1] >= regs_[rs2]);
-            break;
-        default:
-            throw std::runtime_error("ILLEGAL_BRANCH");
-    }
 
-    
-
-    if (take) {
-        next_pc = pc_ + (uint32_t)off;
-    }
-}
-    else if (opcode == 0x33) {
-    // R-type ALU ops
-    uint32_t a = regs_[rs1];
-    uint32_t b = regs_[rs2];
-    uint32_t val = 0;
-
-    switch (funct3) {
-        case 0x0: // ADD/SUB
-            if (funct7 == 0x00) { mnemonic = "add"; val = a + b; }
-            else if (funct7 == 0x20) { mnemonic = "sub"; val = a - b; }
-            else throw std::runtime_error("ILLEGAL_RTYPE");
+        case Op::Add: case Op::Sub: case Op::Sll: case Op::Slt: case Op::Sltu:
+        case Op::Xor: case Op::Srl: case Op::Sra: case Op::Or: case Op::And:
+        case Op::Mul: case Op::Mulh: case Op::Mulhsu: case Op::Mulhu:
+        case Op::Div: case Op::Divu: case Op::Rem: case Op::Remu:
+            out << " x" << rd << ",x" << rs1 << ",x" << rs2;
             break;
 
-        case 0x7: // AND
-            if (funct7 != 0x00) throw std::runtime_error("ILLEGAL_RTYPE");
-            mnemonic = "and"; val = a & b;
+        case Op::Lb: case Op::Lh: case Op::Lw: case Op::Lbu: case Op::Lhu:
+        case Op::Jalr:
+            out << " x" << rd << "," << d.imm << "(x" << rs1 << ")";
             break;
 
-        case 0x6: // OR
-            if (funct7 != 0x00) throw std::runtime_error("ILLEGAL_RTYPE");
-            mnemonic = "or"; val = a | b;
+        case Op::Sb: case Op::Sh: case Op::Sw:
+            out << " x" << rs2 << "," << d.imm << "(x" << rs1 << ")";
             break;
 
-        case 0x4: // XOR
-            if (funct7 != 0x00) throw std::runtime_error("ILLEGAL_RTYPE");
-            mnemonic = "xor"; val = a ^ b;
+        case Op::Jal:
+            out << " x" << rd << "," << d.imm;
             break;
 
-        case 0x2: // SLT (signed)
-            if (funct7 != 0x00) throw std::runtime_error("ILLEGAL_RTYPE");
-            mnemonic = "slt"; val = ((int32_t)a < (int32_t)b) ? 1u : 0u;
+        case Op::Beq: case Op::Bne: case Op::Blt:
+        case Op::Bge: case Op::Bltu: case Op::Bgeu:
+            out << " x" << rs1 << ",x" << rs2 << "," << d.imm;
             break;
 
-        case 0x3: // SLTU (unsigned)
-            if (funct7 != 0x00) throw std::runtime_error("ILLEGAL_RTYPE");
-            mnemonic = "sltu"; val = (a < b) ? 1u : 0u;
+        case Op::Lui: case Op::Auipc:
+            out << " x" << rd << ",0x" << std::hex << (uint32_t)d.imm << std::dec;
             break;
 
-        case 0x1: // SLL
-            if (funct7 != 0x00) throw std::runtime_error("ILLEGAL_RTYPE");
-            mnemonic = "sll"; val = a << (b & 31u);
+        case Op::Csrrw: case Op::Csrrs: case Op::Csrrc:
+            out << " x" << rd << ",0x" << std::hex << (uint32_t)d.imm
+                      << ",x" << std::dec << rs1;
             break;
 
-        case 0x5: // SRL/SRA
-            if (funct7 == 0x00) { mnemonic = "srl"; val = a >> (b & 31u); }
-            else if (funct7 == 0x20) { mnemonic = "sra"; val = (uint32_t)((int32_t)a >> (b & 31u)); }
-            else throw std::runtime_error("ILLEGAL_RTYPE");
+        case Op::Csrrwi: case Op::Csrrsi: case Op::Csrrci:
+            out << " x" << rd << ",0x" << std::hex << (uint32_t)d.imm
+                      << "," << std::dec << rs1; // rs1 is zimm
             break;
 
         default:
-            throw std::runtime_error("ILLEGAL_RTYPE");
+            // no operands to print
+            break;
     }
 
-    if (rd != 0) {
-        regs_[rd] = val;
-        wb_reg = (int)rd;
-        wb_val = val;
+    if (wb_reg >= 0) {
+        out << " WB: x" << wb_reg << "=0x"
+                  << std::hex << std::setw(8) << std::setfill('0') << wb_val
+                  << std::dec;
     }
+    out << "\n";
 }
-    else {
-        if (trace_) {
-            std::cout << "PC=0x" << std::hex << std::setw(8) << std::setfill('0') << pc_before
-                      << " INST=0x" << std::setw(8) << inst_before
-                      << " illegal"
-                      << std::dec << "\n";
-        }
-        throw std::runtime_error("ILLEGAL");
-    }
-
-    regs_[0] = 0;
-    pc_ = next_pc;
 
-    // Print trace AFTER execution (so WB values are final)
-    if (trace_ && inst != 0x00100073 && inst != 0x00000073) {
-        std::cout << "PC=0x" << std::hex << std::setw(8) << std::setfill('0') << pc_before
-                  << " INST=0x" << std::setw(8) << inst_before
-                  << " " << mnemonic;
-
-        // print operands for our 2 instructions
-    if (std::string(mnemonic) == "addi" || std::string(mnemonic) == "andi" ||
-         std::string(mnemonic) == "ori"  || std::string(mnemonic) == "xori" ||
-         std::string(mnemonic) == "slti" || std::string(mnemonic) == "sltiu"||
-         std::string(mnemonic) == "slli" || std::string(mnemonic) == "srli" ||
-         std::string(mnemonic) == "srai") {
-         std::cout << " x" << rd << ",x" << rs1 << "," << std::dec << imm_for_print;
-}
-        else if (std::string(mnemonic) == "add" || std::string(mnemonic) == "sub" ||
-         std::string(mnemonic) == "and" || std::string(mnemonic) == "or"  ||
-         std::string(mnemonic) == "xor" || std::string(mnemonic) == "slt" ||
-         std::string(mnemonic) == "sltu"|| std::string(mnemonic) == "sll" ||
-         std::string(mnemonic) == "srl" || std::string(mnemonic) == "sra") {
-         std::cout << " x" << rd << ",x" << rs1 << ",x" << rs2;
-}
-
-       else if (std::string(mnemonic) == "lb" || std::string(mnemonic) == "lh" ||
-         std::string(mnemonic) == "lw" || std::string(mnemonic) == "lbu"||
-         std::string(mnemonic) == "lhu") {
-         std::cout << " x" << rd << "," << std::dec << imm_for_print << "(x" << rs1 << ")";
-}
-      else if (std::string(mnemonic) == "sb" || std::string(mnemonic) == "sh" ||
-         std::string(mnemonic) == "sw") {
-         std::cout << " x" << rs2 << "," << std::dec << imm_for_print << "(x" << rs1 << ")";
-}
-
-       else if (std::string(mnemonic) == "jal") {
-         std::cout << " x" << rd << "," << std::dec << imm_for_print;
-}
-       else if (std::string(mnemonic) == "jalr") {
-         std::cout << " x" << rd << "," << std::dec << imm_for_print << "(x" << rs1 << ")";
+uint32_t CPU::csr_read(uint32_t addr) const {
+addr &= 0xFFFu;
+switch (addr) {
+    case kCsrMstatus: return mstatus_ | kMstatusMpp;
+    case kCsrMie:     return mie_;
+    case kCsrMtvec:   return mtvec_;
+    case kCsrMepc:    return mepc_;
+    case kCsrMcause:  return mcause_;
+    case kCsrMtval:   return mtval_;
+    case kCsrMip:     return mip_;
+}
+if (isa_.zicntr) {
+    // cycle/time/instret all count retired instructions
+    switch (addr) {
+        case 0xC00: case 0xC01: case 0xC02: return (uint32_t)instret_;
+        case 0xC80: case 0xC81: case 0xC82: return (uint32_t)(instret_ >> 32);
+    }
 }
-
-        else if (std::string(mnemonic) == "beq" || std::string(mnemonic) == "bne" ||
-         std::string(mnemonic) == "blt" || std::string(mnemonic) == "bge" ||
-         std::string(mnemonic) == "bltu"|| std::string(mnemonic) == "bgeu") {
-         std::cout << " x" << rs1 << ",x" << rs2 << "," << std::dec << imm_for_print;
+for (const auto& c : csr_) {
+    if (c.first == addr) return c.second;
 }
-       else if (std::string(mnemonic) == "lui" || std::string(mnemonic) == "auipc") {
-         std::cout << " x" << rd << ",0x" << std::hex << (uint32_t)imm_for_print << std::dec;
+return 0;
 }
 
-       else if (std::string(mnemonic) == "fence" || std::string(mnemonic) == "fence.i") {
-       // no operands to print
-}
-       else if (std::string(mnemonic) == "csrrw"  ||
-         std::string(mnemonic) == "csrrs"  ||
-         std::string(mnemonic) == "csrrc") {
-         uint32_t csr_addr = get_bits(inst_before, 31, 20);
-         std::cout << " x" << rd << ",0x" << std::hex << csr_addr
-              << ",x" << std::dec << rs1;
-}
-    else if (std::string(mnemonic) == "csrrwi" ||
-         std::string(mnemonic) == "csrrsi" ||
-         std::string(mnemonic) == "csrrci") {
-         uint32_t csr_addr = get_bits(inst_before, 31, 20);
-         std::cout << " x" << rd << ",0x" << std::hex << csr_addr
-              << "," << std::dec << rs1; // rs1 is zimm
+void CPU::csr_write(uint32_t addr, uint32_t value) {
+addr &= 0xFFFu;
+switch (addr) {
+    // Enabling an interrupt that is already pending must take effect
+    // before the next instruction, not at the end of the stretch.
+    case kCsrMstatus: mstatus_ = value & (kMstatusMie | kMstatusMpie); end_stretch(); return;
+    case kCsrMie:     mie_ = value; end_stretch(); return;
+    case kCsrMtvec:   mtvec_ = value; return;
+    case kCsrMepc:    mepc_ = value & ~1u; return;
+    case kCsrMcause:  mcause_ = value; return;
+    case kCsrMtval:   mtval_ = value; return;
+    case kCsrMip:     return; // pending bits are driven by devices
 }
-
-        if (wb_reg >= 0) {
-        std::cout << " WB: x" << wb_reg << "=0x"
-        << std::hex << std::setw(8) << std::setfill('0') << wb_val
-        << std::dec;
-        }   
-        std::cout << "\n";
-    }
+for (auto& c : csr_) {
+    if (c.first == addr) { c.second = value; return; }
 }
-
-uint32_t CPU::csr_read(uint32_t addr) const {
-return csr_[addr & 0xFFFu];
+csr_.emplace_back((uint16_t)addr, value);
 }
 
 }
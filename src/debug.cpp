@@ -0,0 +1,32 @@
+#include "rv/debug.hpp"
+#include "rv/cpu.hpp"
+
+#include <iomanip>
+
+namespace rv {
+
+void write_machine_state(std::ostream& out, const CPU& cpu, const DebugStop* why) {
+    const auto flags = out.flags();
+    const char fill = out.fill();
+    out << std::hex << std::setfill('0');
+
+    if (why && why->kind() == DebugStop::Kind::Breakpoint) {
+        out << "BREAKPOINT at pc=0x" << std::setw(8) << why->addr() << "\n";
+    } else if (why) {
+        out << "WATCHPOINT " << (why->is_write() ? "write" : "read") << " of "
+            << std::dec << why->size() << std::hex << " byte(s) at 0x"
+            << std::setw(8) << why->addr() << "\n";
+    }
+
+    out << "pc=0x" << std::setw(8) << cpu.pc() << " instret=" << std::dec << cpu.instret()
+        << std::hex << "\n";
+    for (int i = 0; i < 32; i++) {
+        out << "x" << std::dec << i << (i < 10 ? " " : "") << std::hex
+            << "=0x" << std::setw(8) << cpu.reg(i) << ((i % 4 == 3) ? "\n" : "  ");
+    }
+
+    out.flags(flags);
+    out.fill(fill);
+}
+
+} // namespace rv
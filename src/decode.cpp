@@ -0,0 +1,385 @@
+#include "rv/decode.hpp"
+#include "rv/memory.hpp"
+
+namespace rv {
+
+static inline uint32_t get_bits(uint32_t x, int hi, int lo) {
+    return (x >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+static inline int32_t sign_extend(uint32_t x, int bits) {
+    uint32_t m = 1u << (bits - 1);
+    return (int32_t)((x ^ m) - m);
+}
+
+static inline int32_t imm_i(uint32_t inst) {
+    return sign_extend(get_bits(inst, 31, 20), 12);
+}
+
+static inline int32_t imm_s(uint32_t inst) {
+    return sign_extend((get_bits(inst, 31, 25) << 5) | get_bits(inst, 11, 7), 12);
+}
+
+static inline int32_t imm_b(uint32_t inst) {
+    // B-type: imm[12|10:5|4:1|11] from bits [31|30:25|11:8|7], LSB is 0
+    uint32_t imm =
+        (get_bits(inst, 31, 31) << 12) |
+        (get_bits(inst, 7, 7)   << 11) |
+        (get_bits(inst, 30, 25) << 5)  |
+        (get_bits(inst, 11, 8)  << 1);
+    return sign_extend(imm, 13);
+}
+
+static inline int32_t imm_j(uint32_t inst) {
+    // J-type: imm[20|10:1|11|19:12] from bits [31|30:21|20|19:12], LSB is 0
+    uint32_t imm =
+        (get_bits(inst, 31, 31) << 20) |
+        (get_bits(inst, 19, 12) << 12) |
+        (get_bits(inst, 20, 20) << 11) |
+        (get_bits(inst, 30, 21) << 1);
+    return sign_extend(imm, 21);
+}
+
+DecodedInst decode(uint32_t inst, const Isa& isa) {
+    DecodedInst d;
+    d.inst = inst;
+    d.raw = inst;
+
+    const uint32_t opcode = get_bits(inst, 6, 0);
+    const uint32_t funct3 = get_bits(inst, 14, 12);
+    const uint32_t funct7 = get_bits(inst, 31, 25);
+    d.rd  = (uint8_t)get_bits(inst, 11, 7);
+    d.rs1 = (uint8_t)get_bits(inst, 19, 15);
+    d.rs2 = (uint8_t)get_bits(inst, 24, 20);
+
+    Op op = Op::Illegal;
+
+    switch (opcode) {
+        case 0x37: // LUI
+            op = Op::Lui;
+            d.imm = (int32_t)(inst & 0xFFFFF000u);
+            break;
+
+        case 0x17: // AUIPC
+            op = Op::Auipc;
+            d.imm = (int32_t)(inst & 0xFFFFF000u);
+            break;
+
+        case 0x6F: // JAL
+            op = Op::Jal;
+            d.imm = imm_j(inst);
+            break;
+
+        case 0x67: // JALR
+            if (funct3 == 0x0) op = Op::Jalr;
+            d.imm = imm_i(inst);
+            break;
+
+        case 0x63: { // Branches
+            static const Op kBranch[8] = {
+                Op::Beq, Op::Bne, Op::Illegal, Op::Illegal,
+                Op::Blt, Op::Bge, Op::Bltu, Op::Bgeu
+            };
+            op = kBranch[funct3];
+            d.imm = imm_b(inst);
+            break;
+        }
+
+        case 0x03: { // Loads
+            static const Op kLoad[8] = {
+                Op::Lb, Op::Lh, Op::Lw, Op::Illegal,
+                Op::Lbu, Op::Lhu, Op::Illegal, Op::Illegal
+            };
+            op = kLoad[funct3];
+            d.imm = imm_i(inst);
+            break;
+        }
+
+        case 0x23: { // Stores
+            static const Op kStore[8] = {
+                Op::Sb, Op::Sh, Op::Sw, Op::Illegal,
+                Op::Illegal, Op::Illegal, Op::Illegal, Op::Illegal
+            };
+            op = kStore[funct3];
+            d.imm = imm_s(inst);
+            break;
+        }
+
+        case 0x13: // I-type ALU
+            d.imm = imm_i(inst);
+            switch (funct3) {
+                case 0x0: op = Op::Addi; break;
+                case 0x2: op = Op::Slti; break;
+                case 0x3: op = Op::Sltiu; break;
+                case 0x4: op = Op::Xori; break;
+                case 0x6: op = Op::Ori; break;
+                case 0x7: op = Op::Andi; break;
+                case 0x1: // SLLI (shamt in [24:20], funct7 must be 0)
+                    if (funct7 == 0x00) op = Op::Slli;
+                    d.imm = (int32_t)d.rs2;
+                    break;
+                case 0x5: // SRLI/SRAI
+                    if (funct7 == 0x00) op = Op::Srli;
+                    else if (funct7 == 0x20) op = Op::Srai;
+                    d.imm = (int32_t)d.rs2;
+                    break;
+            }
+            break;
+
+        case 0x33: // R-type ALU
+            if (funct7 == 0x00) {
+                static const Op kAlu[8] = {
+                    Op::Add, Op::Sll, Op::Slt, Op::Sltu,
+                    Op::Xor, Op::Srl, Op::Or, Op::And
+                };
+                op = kAlu[funct3];
+            } else if (funct7 == 0x20) {
+                if (funct3 == 0x0) op = Op::Sub;
+                else if (funct3 == 0x5) op = Op::Sra;
+            } else if (funct7 == 0x01 && isa.m) {
+                static const Op kMul[8] = {
+                    Op::Mul, Op::Mulh, Op::Mulhsu, Op::Mulhu,
+                    Op::Div, Op::Divu, Op::Rem, Op::Remu
+                };
+                op = kMul[funct3];
+            }
+            break;
+
+        case 0x0F: // FENCE / FENCE.I
+            op = (funct3 == 0x1) ? Op::FenceI : Op::Fence;
+            break;
+
+        case 0x73: // SYSTEM
+            if (inst == 0x00000073u) op = Op::Ecall;
+            else if (inst == 0x00100073u) op = Op::Ebreak;
+            else if (inst == 0x30200073u) op = Op::Mret;
+            else if (inst == 0x10500073u) op = Op::Wfi;
+            else if (funct3 != 0x0 && funct3 != 0x4) {
+                static const Op kCsr[8] = {
+                    Op::Illegal, Op::Csrrw, Op::Csrrs, Op::Csrrc,
+                    Op::Illegal, Op::Csrrwi, Op::Csrrsi, Op::Csrrci
+                };
+                op = kCsr[funct3];
+                d.imm = (int32_t)get_bits(inst, 31, 20);
+            }
+            break;
+    }
+
+    d.op = op;
+    return d;
+}
+
+DecodedInst fetch_decode(const Memory& mem, uint32_t pc, const Isa& isa) {
+    DecodedInst d;
+    if (!isa.c) {
+        d = decode(mem.load32(pc), isa); // load32 rejects misaligned PCs
+    } else {
+        // 16-bit parcels: a 32-bit instruction may sit on any 2-byte boundary.
+        uint16_t lo = mem.load16(pc);
+        if ((lo & 0x3u) != 0x3u) {
+            d = decode(expand_compressed(lo), isa);
+            d.raw = lo;
+            d.len = 2;
+        } else {
+            d = decode(lo | ((uint32_t)mem.load16(pc + 2) << 16), isa);
+        }
+    }
+    d.pc = pc;
+    return d;
+}
+
+// ---- RV32C expansion ----
+
+static inline uint32_t enc_r(uint32_t f7, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t opc) {
+    return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+}
+
+static inline uint32_t enc_i(int32_t imm, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t opc) {
+    return (((uint32_t)imm & 0xFFFu) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+}
+
+static inline uint32_t enc_s(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = (uint32_t)imm;
+    return (get_bits(u, 11, 5) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (get_bits(u, 4, 0) << 7) | 0x23;
+}
+
+static inline uint32_t enc_b(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = (uint32_t)imm;
+    return (get_bits(u, 12, 12) << 31) | (get_bits(u, 10, 5) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (f3 << 12) | (get_bits(u, 4, 1) << 8) | (get_bits(u, 11, 11) << 7) | 0x63;
+}
+
+static inline uint32_t enc_j(int32_t imm, uint32_t rd) {
+    uint32_t u = (uint32_t)imm;
+    return (get_bits(u, 20, 20) << 31) | (get_bits(u, 10, 1) << 21) | (get_bits(u, 11, 11) << 20) |
+           (get_bits(u, 19, 12) << 12) | (rd << 7) | 0x6F;
+}
+
+static inline int32_t c_imm6(uint32_t c) {
+    // imm[5] from bit 12, imm[4:0] from bits 6:2
+    return sign_extend((get_bits(c, 12, 12) << 5) | get_bits(c, 6, 2), 6);
+}
+
+static inline int32_t c_imm_j(uint32_t c) {
+    // offset[11|4|9:8|10|6|7|3:1|5] from bits [12|11|10:9|8|7|6|5:3|2]
+    uint32_t imm =
+        (get_bits(c, 12, 12) << 11) |
+        (get_bits(c, 11, 11) << 4)  |
+        (get_bits(c, 10, 9)  << 8)  |
+        (get_bits(c, 8, 8)   << 10) |
+        (get_bits(c, 7, 7)   << 6)  |
+        (get_bits(c, 6, 6)   << 7)  |
+        (get_bits(c, 5, 3)   << 1)  |
+        (get_bits(c, 2, 2)   << 5);
+    return sign_extend(imm, 12);
+}
+
+static inline int32_t c_imm_b(uint32_t c) {
+    // offset[8|4:3] from bits [12|11:10], offset[7:6|2:1|5] from bits [6:5|4:3|2]
+    uint32_t imm =
+        (get_bits(c, 12, 12) << 8) |
+        (get_bits(c, 11, 10) << 3) |
+        (get_bits(c, 6, 5)   << 6) |
+        (get_bits(c, 4, 3)   << 1) |
+        (get_bits(c, 2, 2)   << 5);
+    return sign_extend(imm, 9);
+}
+
+uint32_t expand_compressed(uint16_t parcel) {
+    const uint32_t c = parcel;
+    const uint32_t funct3 = get_bits(c, 15, 13);
+    const uint32_t rd   = get_bits(c, 11, 7);        // also rs1
+    const uint32_t rs2  = get_bits(c, 6, 2);
+    const uint32_t rdp  = get_bits(c, 4, 2) + 8;     // rd'/rs2'
+    const uint32_t rs1p = get_bits(c, 9, 7) + 8;     // rs1'/rd'
+
+    switch (get_bits(c, 1, 0)) {
+        case 0x0: // Quadrant 0
+            switch (funct3) {
+                case 0x0: { // C.ADDI4SPN
+                    uint32_t imm =
+                        (get_bits(c, 12, 11) << 4) |
+                        (get_bits(c, 10, 7)  << 6) |
+                        (get_bits(c, 6, 6)   << 2) |
+                        (get_bits(c, 5, 5)   << 3);
+                    if (imm == 0) return 0;
+                    return enc_i((int32_t)imm, 2, 0x0, rdp, 0x13);
+                }
+                case 0x2: { // C.LW
+                    uint32_t imm = (get_bits(c, 12, 10) << 3) | (get_bits(c, 6, 6) << 2) | (get_bits(c, 5, 5) << 6);
+                    return enc_i((int32_t)imm, rs1p, 0x2, rdp, 0x03);
+                }
+                case 0x6: { // C.SW
+                    uint32_t imm = (get_bits(c, 12, 10) << 3) | (get_bits(c, 6, 6) << 2) | (get_bits(c, 5, 5) << 6);
+                    return enc_s((int32_t)imm, rdp, rs1p, 0x2);
+                }
+                default: // FP loads/stores and reserved
+                    return 0;
+            }
+
+        case 0x1: // Quadrant 1
+            switch (funct3) {
+                case 0x0: // C.ADDI / C.NOP
+                    return enc_i(c_imm6(c), rd, 0x0, rd, 0x13);
+                case 0x1: // C.JAL
+                    return enc_j(c_imm_j(c), 1);
+                case 0x2: // C.LI
+                    return enc_i(c_imm6(c), 0, 0x0, rd, 0x13);
+                case 0x3:
+                    if (rd == 2) { // C.ADDI16SP
+                        uint32_t imm =
+                            (get_bits(c, 12, 12) << 9) |
+                            (get_bits(c, 6, 6)   << 4) |
+                            (get_bits(c, 5, 5)   << 6) |
+                            (get_bits(c, 4, 3)   << 7) |
+                            (get_bits(c, 2, 2)   << 5);
+                        if (imm == 0) return 0;
+                        return enc_i(sign_extend(imm, 10), 2, 0x0, 2, 0x13);
+                    } else { // C.LUI
+                        int32_t imm = c_imm6(c);
+                        if (imm == 0) return 0;
+                        return ((uint32_t)imm << 12) | (rd << 7) | 0x37;
+                    }
+                case 0x4:
+                    switch (get_bits(c, 11, 10)) {
+                        case 0x0: // C.SRLI
+                            if (get_bits(c, 12, 12)) return 0;
+                            return enc_r(0x00, rs2, rs1p, 0x5, rs1p, 0x13);
+                        case 0x1: // C.SRAI
+                            if (get_bits(c, 12, 12)) return 0;
+                            return enc_r(0x20, rs2, rs1p, 0x5, rs1p, 0x13);
+                        case 0x2: // C.ANDI
+                            return enc_i(c_imm6(c), rs1p, 0x7, rs1p, 0x13);
+                        default:
+                            if (get_bits(c, 12, 12)) return 0; // RV64 SUBW/ADDW
+                            switch (get_bits(c, 6, 5)) {
+                                case 0x0: return enc_r(0x20, rdp, rs1p, 0x0, rs1p, 0x33); // C.SUB
+                                case 0x1: return enc_r(0x00, rdp, rs1p, 0x4, rs1p, 0x33); // C.XOR
+                                case 0x2: return enc_r(0x00, rdp, rs1p, 0x6, rs1p, 0x33); // C.OR
+                                default:  return enc_r(0x00, rdp, rs1p, 0x7, rs1p, 0x33); // C.AND
+                            }
+                    }
+                case 0x5: // C.J
+                    return enc_j(c_imm_j(c), 0);
+                case 0x6: // C.BEQZ
+                    return enc_b(c_imm_b(c), 0, rs1p, 0x0);
+                default:  // C.BNEZ
+                    return enc_b(c_imm_b(c), 0, rs1p, 0x1);
+            }
+
+        case 0x2: // Quadrant 2
+            switch (funct3) {
+                case 0x0: // C.SLLI
+                    if (get_bits(c, 12, 12)) return 0;
+                    return enc_r(0x00, rs2, rd, 0x1, rd, 0x13);
+                case 0x2: { // C.LWSP
+                    if (rd == 0) return 0;
+                    uint32_t imm = (get_bits(c, 12, 12) << 5) | (get_bits(c, 6, 4) << 2) | (get_bits(c, 3, 2) << 6);
+                    return enc_i((int32_t)imm, 2, 0x2, rd, 0x03);
+                }
+                case 0x4:
+                    if (get_bits(c, 12, 12) == 0) {
+                        if (rs2 == 0) { // C.JR
+                            if (rd == 0) return 0;
+                            return enc_i(0, rd, 0x0, 0, 0x67);
+                        }
+                        return enc_r(0x00, rs2, 0, 0x0, rd, 0x33); // C.MV
+                    }
+                    if (rs2 == 0) {
+                        if (rd == 0) return 0x00100073u;        // C.EBREAK
+                        return enc_i(0, rd, 0x0, 1, 0x67);      // C.JALR
+                    }
+                    return enc_r(0x00, rs2, rd, 0x0, rd, 0x33); // C.ADD
+                case 0x6: { // C.SWSP
+                    uint32_t imm = (get_bits(c, 12, 9) << 2) | (get_bits(c, 8, 7) << 6);
+                    return enc_s((int32_t)imm, rs2, 2, 0x2);
+                }
+                default: // FP loads/stores
+                    return 0;
+            }
+
+        default: // not a compressed parcel
+            return 0;
+    }
+}
+
+const char* op_name(Op op) {
+    static const char* const kNames[] = {
+        "illegal",
+        "lui", "auipc", "jal", "jalr",
+        "beq", "bne", "blt", "bge", "bltu", "bgeu",
+        "lb", "lh", "lw", "lbu", "lhu",
+        "sb", "sh", "sw",
+        "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+        "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+        "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+        "fence", "fence.i",
+        "ecall", "ebreak", "mret", "wfi",
+        "csrrw", "csrrs", "csrrc", "csrrwi", "csrrsi", "csrrci",
+        "breakpoint",
+    };
+    static_assert(sizeof(kNames) / sizeof(kNames[0]) == (std::size_t)Op::Count, "op name table out of sync");
+    return kNames[(std::size_t)op];
+}
+
+} // namespace rv
@@ -0,0 +1,116 @@
+#include "rv/elf.hpp"
+#include "rv/memory.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace rv {
+
+namespace {
+
+constexpr uint16_t kEmRiscv = 243;
+constexpr uint32_t kPtLoad = 1;
+constexpr uint32_t kShtSymtab = 2;
+
+constexpr std::size_t kEhdrSize = 52;
+constexpr std::size_t kPhdrSize = 32;
+constexpr std::size_t kShdrSize = 40;
+constexpr std::size_t kSymSize = 16;
+
+// Bounds-checked little-endian field access into the file image.
+struct Reader {
+    const uint8_t* p;
+    std::size_t size;
+
+    void need(std::size_t off, std::size_t n) const {
+        if (off > size || n > size - off) throw std::runtime_error("ELF: truncated file");
+    }
+    uint16_t u16(std::size_t off) const {
+        need(off, 2);
+        return (uint16_t)(p[off] | (p[off + 1] << 8));
+    }
+    uint32_t u32(std::size_t off) const {
+        need(off, 4);
+        return (uint32_t)p[off] | ((uint32_t)p[off + 1] << 8) |
+               ((uint32_t)p[off + 2] << 16) | ((uint32_t)p[off + 3] << 24);
+    }
+};
+
+} // namespace
+
+ElfImage load_elf(Memory& mem, const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open ELF file: " + path);
+    }
+    std::vector<uint8_t> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return load_elf(mem, buf.data(), buf.size());
+}
+
+ElfImage load_elf(Memory& mem, const void* data, std::size_t size) {
+    const Reader r{static_cast<const uint8_t*>(data), size};
+    r.need(0, kEhdrSize);
+    if (std::memcmp(r.p, "\x7f" "ELF", 4) != 0) throw std::runtime_error("ELF: bad magic");
+    if (r.p[4] != 1 || r.p[5] != 1) throw std::runtime_error("ELF: not a 32-bit little-endian file");
+    if (r.u16(18) != kEmRiscv) throw std::runtime_error("ELF: not a RISC-V file");
+
+    ElfImage img;
+    img.entry = r.u32(24);
+
+    const uint32_t phoff = r.u32(28);
+    const uint16_t phentsize = r.u16(42);
+    const uint16_t phnum = r.u16(44);
+    if (phnum != 0 && phentsize < kPhdrSize) throw std::runtime_error("ELF: bad program header size");
+
+    for (uint16_t i = 0; i < phnum; i++) {
+        const std::size_t ph = (std::size_t)phoff + (std::size_t)i * phentsize;
+        if (r.u32(ph) != kPtLoad) continue;
+        const uint32_t offset = r.u32(ph + 4);
+        const uint32_t paddr = r.u32(ph + 12);
+        const uint32_t filesz = r.u32(ph + 16);
+        const uint32_t memsz = r.u32(ph + 20);
+        if (filesz > memsz) throw std::runtime_error("ELF: segment file size exceeds memory size");
+
+        r.need(offset, filesz);
+        mem.write_block(paddr, r.p + offset, filesz);
+        if (memsz > filesz) {
+            const std::vector<uint8_t> zeros(memsz - filesz);
+            mem.write_block(paddr + filesz, zeros.data(), zeros.size());
+        }
+        if (paddr + memsz > img.end) img.end = paddr + memsz;
+    }
+
+    // Symbols are optional; tests use them to find tohost and friends.
+    const uint32_t shoff = r.u32(32);
+    const uint16_t shentsize = r.u16(46);
+    const uint16_t shnum = r.u16(48);
+    if (shoff == 0 || shnum == 0 || shentsize < kShdrSize) return img;
+
+    for (uint16_t i = 0; i < shnum; i++) {
+        const std::size_t sh = (std::size_t)shoff + (std::size_t)i * shentsize;
+        if (r.u32(sh + 4) != kShtSymtab) continue;
+        const uint32_t sym_off = r.u32(sh + 16);
+        const uint32_t sym_size = r.u32(sh + 20);
+        const uint32_t link = r.u32(sh + 24);
+        if (link >= shnum) throw std::runtime_error("ELF: bad symbol string table");
+        const std::size_t strtab = (std::size_t)shoff + (std::size_t)link * shentsize;
+        const uint32_t str_off = r.u32(strtab + 16);
+        const uint32_t str_size = r.u32(strtab + 20);
+        r.need(str_off, str_size);
+        r.need(sym_off, sym_size);
+
+        for (std::size_t s = sym_off; s + kSymSize <= (std::size_t)sym_off + sym_size; s += kSymSize) {
+            const uint32_t name = r.u32(s);
+            if (name == 0 || name >= str_size) continue;
+            const char* str = reinterpret_cast<const char*>(r.p + str_off + name);
+            const std::size_t len = strnlen(str, str_size - name);
+            img.symbols.emplace(std::string(str, len), r.u32(s + 4));
+        }
+    }
+    return img;
+}
+
+} // namespace rv
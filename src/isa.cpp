@@ -0,0 +1,45 @@
+#include "rv/isa.hpp"
+
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+namespace rv {
+
+Isa parse_isa(const std::string& str) {
+    std::string s;
+    for (char c : str) s.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+
+    auto bad = [&](const std::string& why) {
+        return std::invalid_argument("Unsupported ISA string '" + str + "': " + why);
+    };
+
+    if (s.rfind("rv32i", 0) != 0) throw bad("expected rv32i prefix");
+
+    Isa isa;
+    std::size_t i = 5;
+
+    // Single-letter extensions, in any order.
+    for (; i < s.size() && s[i] != '_'; i++) {
+        switch (s[i]) {
+            case 'm': isa.m = true; break;
+            case 'c': isa.c = true; break;
+            default: throw bad(std::string("unknown extension '") + s[i] + "'");
+        }
+    }
+
+    // Multi-letter extensions, '_' separated.
+    std::istringstream rest(s.substr(i));
+    std::string ext;
+    while (std::getline(rest, ext, '_')) {
+        if (ext.empty()) continue;
+        if (ext == "zicsr") continue;    // CSR instructions are always available
+        if (ext == "zifencei") continue; // and so is FENCE.I
+        if (ext == "zicntr") { isa.zicntr = true; continue; }
+        throw bad("unknown extension '" + ext + "'");
+    }
+
+    return isa;
+}
+
+} // namespace rv
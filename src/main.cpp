@@ -1,37 +1,248 @@
 #include "rv/memory.hpp"
+#include "rv/block.hpp"
+#include "rv/clint.hpp"
+#include "rv/cosim.hpp"
 #include "rv/cpu.hpp"
+#include "rv/debug.hpp"
+#include "rv/isa.hpp"
+#include "rv/replay.hpp"
+#include "rv/stats.hpp"
+#include "rv/syscall.hpp"
+#include "rv/uart.hpp"
+#include <csignal>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
+#include <vector>
+
+namespace {
+
+// Set by SIGUSR1; main checks it between run() chunks.
+volatile std::sig_atomic_t g_dump_stats = 0;
+
+extern "C" void request_stats_dump(int) { g_dump_stats = 1; }
+
+// Instructions per run() call, i.e. how often SIGUSR1 is noticed.
+constexpr uint64_t kRunChunk = 1u << 22;
+
+struct WatchSpec {
+    uint32_t addr;
+    uint32_t len;
+    uint8_t access;
+};
+
+// <addr>[:<len>][:r|w|rw], length defaulting to 4 and access to w.
+WatchSpec parse_watch(const std::string& s) {
+    WatchSpec w{0, 4, rv::Memory::kWatchWrite};
+    std::size_t pos = 0;
+    w.addr = static_cast<uint32_t>(std::stoul(s, &pos, 0));
+    while (pos < s.size() && s[pos] == ':') {
+        const std::size_t next = s.find(':', pos + 1);
+        const std::string field = s.substr(pos + 1, next == std::string::npos ? next : next - pos - 1);
+        if (field == "r") w.access = rv::Memory::kWatchRead;
+        else if (field == "w") w.access = rv::Memory::kWatchWrite;
+        else if (field == "rw") w.access = rv::Memory::kWatchRead | rv::Memory::kWatchWrite;
+        else w.len = static_cast<uint32_t>(std::stoul(field, nullptr, 0));
+        pos = next;
+    }
+    if (pos != std::string::npos && pos != s.size()) throw std::invalid_argument("bad --watch: " + s);
+    return w;
+}
+
+} // namespace
 
 int main(int argc, char** argv) {
     bool trace = false;
+    std::string isa = "rv32i";
     std::string bin_path;
+    std::string commit_log_path; // write a commit log
+    std::string cosim_path;      // compare against a commit log
+    std::string stats_path;      // JSON statistics at exit ("-": stderr)
+    std::vector<uint32_t> breakpoints;
+    std::vector<WatchSpec> watchpoints;
+    bool debug_continue = false; // keep running after a debug stop
+    std::string disk_path;       // BlockDevice image
+    std::string record_path;     // log nondeterministic inputs
+    std::string replay_path;     // feed them back from a log
+    bool disk_read_only = false;
 
     // parse args
     for (int i = 1; i < argc; i++) {
         std::string a = argv[i];
         if (a == "--trace") trace = true;
+        else if (a == "--isa" && i + 1 < argc) isa = argv[++i];
+        else if (a == "--commit-log" && i + 1 < argc) commit_log_path = argv[++i];
+        else if (a == "--cosim" && i + 1 < argc) cosim_path = argv[++i];
+        else if (a == "--stats" && i + 1 < argc) stats_path = argv[++i];
+        else if (a == "--record" && i + 1 < argc) record_path = argv[++i];
+        else if (a == "--replay" && i + 1 < argc) replay_path = argv[++i];
+        else if (a == "--debug-continue") debug_continue = true;
+        else if ((a == "--disk" || a == "--disk-ro") && i + 1 < argc) {
+            disk_path = argv[++i];
+            disk_read_only = (a == "--disk-ro");
+        }
+        else if ((a == "--break" || a == "--watch") && i + 1 < argc) {
+            try {
+                if (a == "--break") breakpoints.push_back(static_cast<uint32_t>(std::stoul(argv[++i], nullptr, 0)));
+                else watchpoints.push_back(parse_watch(argv[++i]));
+            } catch (const std::exception&) {
+                std::cerr << "Bad address for " << a << ": " << argv[i] << "\n";
+                return 1;
+            }
+        }
         else bin_path = a;
     }
 
-    if (bin_path.empty()) {
-        std::cerr << "Usage: rv32i_iss [--trace] <test.bin>\n";
+    if (bin_path.empty() || (!commit_log_path.empty() && !cosim_path.empty()) ||
+        (!record_path.empty() && !replay_path.empty())) {
+        std::cerr << "Usage: rv32i_iss [--trace] [--isa rv32im] "
+                     "[--commit-log <out> | --cosim <golden>] [--stats <out.json>] "
+                     "[--break <pc>]... [--watch <addr>[:len][:r|w|rw]]... [--debug-continue] "
+                     "[--disk <image> | --disk-ro <image>] [--record <log> | --replay <log>] "
+                     "<test.bin>\n";
         return 1;
     }
 
+    // With the commit log on stdout, console output, guest writes to fd 1
+    // and the trace all move to stderr.
+    const bool log_on_stdout = (commit_log_path == "-");
+    std::ostream& console = log_on_stdout ? std::cerr : std::cout;
+
+    rv::Uart uart(console);
     rv::Memory mem(64 * 1024);
-    mem.load_binary(bin_path, 0);
+    mem.map_device(rv::Uart::kBase, rv::Uart::kSize, uart);
+    std::size_t image_size = mem.load_binary(bin_path, 0);
+
+    std::unique_ptr<rv::BlockDevice> disk;
+    if (!disk_path.empty()) {
+        try {
+            // Replay takes disk data from the log; never open the image for writing.
+            disk = std::make_unique<rv::BlockDevice>(mem, disk_path, disk_read_only || !replay_path.empty());
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        mem.map_device(rv::BlockDevice::kBase, rv::BlockDevice::kSize, *disk);
+    }
 
     rv::CPU cpu(mem);
     cpu.reset(0);
+    rv::Clint clint(cpu);
+    mem.map_device(rv::Clint::kBase, rv::Clint::kSize, clint);
     cpu.set_trace(trace);
+    cpu.set_trace_output(console);
+    try {
+        cpu.set_isa(rv::parse_isa(isa));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    // Heap starts on the first 16-byte boundary after the image.
+    rv::Syscalls sys(mem);
+    sys.set_heap_base(static_cast<uint32_t>((image_size + 15) & ~std::size_t{15}));
+    if (log_on_stdout) sys.set_stdout_fd(2);
+    sys.install(cpu);
+    sys.init_stack(cpu);
 
     try {
-        while (true) cpu.step();
+        for (uint32_t pc : breakpoints) cpu.add_breakpoint(pc);
+        for (const auto& w : watchpoints) mem.add_watchpoint(w.addr, w.len, w.access);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<rv::InputLog> input_log;
+    try {
+        if (!record_path.empty()) input_log = std::make_unique<rv::InputLog>(record_path, rv::InputLog::Mode::Record);
+        if (!replay_path.empty()) input_log = std::make_unique<rv::InputLog>(replay_path, rv::InputLog::Mode::Replay);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    mem.set_input_log(input_log.get());
+
+    // "-" means stdout / stdin, e.g. to pipe one simulator into another.
+    std::unique_ptr<rv::CommitLogWriter> commit_log;
+    std::unique_ptr<rv::CommitLogReader> golden;
+    std::unique_ptr<rv::CosimChecker> checker;
+    try {
+        if (!commit_log_path.empty()) {
+            commit_log = std::make_unique<rv::CommitLogWriter>(commit_log_path);
+            cpu.set_commit_sink(commit_log.get());
+        }
+        if (!cosim_path.empty()) {
+            golden = std::make_unique<rv::CommitLogReader>(cosim_path);
+            checker = std::make_unique<rv::CosimChecker>(*golden);
+            cpu.set_commit_sink(checker.get());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    // Statistics go to --stats, or to stderr when only SIGUSR1 asked.
+    auto dump_stats = [&] {
+        if (stats_path.empty() || stats_path == "-") {
+            rv::write_stats_json(std::cerr, cpu.stats(), mem);
+            return;
+        }
+        std::ofstream out(stats_path, std::ios::trunc);
+        if (out) rv::write_stats_json(out, cpu.stats(), mem);
+        else std::cerr << "Cannot write stats: " << stats_path << "\n";
+    };
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, request_stats_dump);
+#endif
+
+    std::optional<int> exit_code;
+    bool diverged = false;
+    try {
+        while (true) {
+            try {
+                cpu.run(kRunChunk);
+            } catch (const rv::DebugStop& stop) {
+                uart.flush();
+                console.flush();
+                rv::write_machine_state(std::cerr, cpu, &stop);
+                if (!debug_continue) throw;
+            }
+            if (g_dump_stats) {
+                g_dump_stats = 0;
+                dump_stats();
+            }
+        }
+    } catch (const rv::GuestExit& e) {
+        exit_code = e.code();
+    } catch (const rv::CosimDivergence& e) {
+        std::cerr << e.report();
+        diverged = true;
+    } catch (const rv::ReplayDivergence& e) {
+        std::cerr << e.report() << " at pc=0x" << std::hex << cpu.pc() << std::dec
+                  << " instret=" << cpu.instret() << "\n";
+        diverged = true;
     } catch (...) {
         // stop
     }
 
-    std::cout << "x3 = " << cpu.reg(3) << "\n";
+    uart.flush();
+    console.flush();
+    if (input_log) input_log->flush();
+    if (!stats_path.empty()) dump_stats();
+    if (diverged) return 2;
+
+    if (checker) {
+        if (!checker->finish()) {
+            std::cerr << checker->report();
+            return 2;
+        }
+        std::cerr << "cosim: " << checker->checked() << " instructions match\n";
+    }
+
+    if (exit_code) return *exit_code;
+    console << "x3 = " << cpu.reg(3) << "\n";
     return 0;
-}
\ No newline at end of file
+}
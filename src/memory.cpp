@@ -1,5 +1,10 @@
 #include "rv/memory.hpp"
+#include "rv/debug.hpp"
+#include "rv/device.hpp"
+#include "rv/replay.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iterator>
 #include <stdexcept>
@@ -7,22 +12,173 @@
 
 namespace rv {
 
-Memory::Memory(std::size_t size_bytes)
-    : mem_(size_bytes, 0) {}
+Memory::Memory(std::size_t size_bytes, std::uint32_t base)
+    : size_(size_bytes),
+      base_(base),
+      pages_((size_bytes + kPageSize - 1) / kPageSize),
+      fast_(pages_.size(), nullptr) {
+    if ((base & (kPageSize - 1)) != 0 || static_cast<std::uint64_t>(base) + size_bytes > 0x100000000ull) {
+        throw std::invalid_argument("Memory: base must be page-aligned and RAM must fit in 32 bits");
+    }
+}
+
+std::size_t Memory::resident_bytes() const {
+    std::size_t n = 0;
+    for (const auto& p : pages_) n += p ? kPageSize : 0;
+    return n;
+}
+
+std::size_t Memory::pages_touched() const {
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < pages_.size(); i++) {
+        n += (pages_[i] || (i < zero_read_.size() && zero_read_[i])) ? 1 : 0;
+    }
+    return n;
+}
 
+// Only unbacked and watched pages get here, so the footprint tracking and
+// watchpoints cost nothing on the common path.
+const std::uint8_t* Memory::read_page_slow(std::uint32_t addr, std::uint32_t nbytes) const {
+    const std::size_t i = page_index(addr);
+    if (!watched_.empty() && watched_[i]) check_watch(addr, nbytes, kWatchRead);
 
+    const std::uint8_t* p = pages_[i].get();
+    if (!p) {
+        if (zero_read_.empty()) zero_read_.resize(pages_.size());
+        zero_read_[i] = true;
+    }
+    return p;
+}
+
+std::uint8_t* Memory::write_page_slow(std::uint32_t addr, std::uint32_t nbytes) {
+    const std::size_t i = page_index(addr);
+    const bool watched = !watched_.empty() && watched_[i];
+    if (watched) check_watch(addr, nbytes, kWatchWrite);
+
+    auto& p = pages_[i];
+    if (!p) p.reset(new std::uint8_t[kPageSize]()); // zero-filled
+    if (!watched) fast_[i] = p.get();
+    return p.get();
+}
+
+void Memory::check_watch(std::uint32_t addr, std::uint32_t nbytes, std::uint8_t access) const {
+    if (watch_suspended_) return;
+    const std::uint64_t end = static_cast<std::uint64_t>(addr) + nbytes;
+    for (const auto& w : watchpoints_) {
+        if (!(w.access & access)) continue;
+        if (addr < static_cast<std::uint64_t>(w.addr) + w.len && w.addr < end) {
+            throw DebugStop(DebugStop::Kind::Watchpoint, addr, nbytes, access == kWatchWrite);
+        }
+    }
+}
+
+void Memory::check_watchpoints(std::uint32_t addr, std::uint32_t nbytes, std::uint8_t access) const {
+    if (!watchpoints_.empty() && nbytes != 0) check_watch(addr, nbytes, access);
+}
+
+void Memory::add_watchpoint(std::uint32_t addr, std::uint32_t len, std::uint8_t access) {
+    if (len == 0 || !in_ram(addr, len) || (access & (kWatchRead | kWatchWrite)) == 0) {
+        throw std::invalid_argument("watchpoint must be a non-empty RAM range with read and/or write access");
+    }
+    watchpoints_.push_back(Watchpoint{addr, len, access});
+    rebuild_watched_pages();
+}
+
+void Memory::remove_watchpoint(std::uint32_t addr, std::uint32_t len) {
+    watchpoints_.erase(std::remove_if(watchpoints_.begin(), watchpoints_.end(),
+                                      [&](const Watchpoint& w) { return w.addr == addr && w.len == len; }),
+                       watchpoints_.end());
+    rebuild_watched_pages();
+}
+
+void Memory::clear_watchpoints() {
+    watchpoints_.clear();
+    rebuild_watched_pages();
+}
+
+void Memory::rebuild_watched_pages() {
+    watched_.assign(watchpoints_.empty() ? 0 : pages_.size(), false);
+    for (const auto& w : watchpoints_) {
+        const std::size_t last = page_index(w.addr + w.len - 1);
+        for (std::size_t i = page_index(w.addr); i <= last; i++) watched_[i] = true;
+    }
+    for (std::size_t i = 0; i < pages_.size(); i++) {
+        const bool watched = !watched_.empty() && watched_[i];
+        fast_[i] = watched ? nullptr : pages_[i].get();
+    }
+}
+
+void Memory::map_device(std::uint32_t base, std::uint32_t size, Device& dev) {
+    const std::uint64_t end = static_cast<std::uint64_t>(base) + size;
+    if (size == 0 || end > 0x100000000ull) {
+        throw std::invalid_argument("map_device: bad region size");
+    }
+    if (base < static_cast<std::uint64_t>(base_) + size_ && end > base_) {
+        throw std::invalid_argument("map_device: region overlaps RAM");
+    }
+
+    auto it = std::lower_bound(regions_.begin(), regions_.end(), base,
+        [](const Region& r, std::uint32_t b) { return r.base < b; });
+    if (it != regions_.end() && end > it->base) {
+        throw std::invalid_argument("map_device: region overlaps another device");
+    }
+    if (it != regions_.begin()) {
+        const Region& prev = *(it - 1);
+        if (static_cast<std::uint64_t>(prev.base) + prev.size > base) {
+            throw std::invalid_argument("map_device: region overlaps another device");
+        }
+    }
+
+    regions_.insert(it, Region{base, size, &dev});
+    last_region_ = 0;
+}
+
+const Memory::Region& Memory::find_region(std::uint32_t addr, std::size_t nbytes) const {
+    auto contains = [&](const Region& r) {
+        return addr >= r.base &&
+               static_cast<std::uint64_t>(addr) + nbytes <= static_cast<std::uint64_t>(r.base) + r.size;
+    };
+
+    // Firmware tends to hammer one device at a time, so try the last hit first.
+    if (last_region_ < regions_.size() && contains(regions_[last_region_])) {
+        return regions_[last_region_];
+    }
+
+    auto it = std::upper_bound(regions_.begin(), regions_.end(), addr,
+        [](std::uint32_t a, const Region& r) { return a < r.base; });
+    if (it != regions_.begin() && contains(*(it - 1))) {
+        last_region_ = static_cast<std::size_t>(it - 1 - regions_.begin());
+        return *(it - 1);
+    }
+
+    check_addr(addr, nbytes); // throws out_of_range
+    throw std::out_of_range("Memory access out of range");
+}
+
+std::uint32_t Memory::device_read(std::uint32_t addr, int nbytes) const {
+    const Region& r = find_region(addr, static_cast<std::size_t>(nbytes));
+    if (!input_log_ || r.dev->deterministic_reads()) return r.dev->read(addr - r.base, nbytes);
+    // Replay must not touch the device: reads can have side effects.
+    const uint32_t live = input_log_->replaying() ? 0 : r.dev->read(addr - r.base, nbytes);
+    return input_log_->value(InputLog::Kind::Device, live);
+}
+
+void Memory::device_write(std::uint32_t addr, std::uint32_t value, int nbytes) {
+    const Region& r = find_region(addr, static_cast<std::size_t>(nbytes));
+    r.dev->write(addr - r.base, value, nbytes);
+}
 
 void Memory::check_addr(std::uint32_t addr, std::size_t nbytes) const {
-    if (static_cast<std::size_t>(addr) + nbytes > mem_.size()) {
+    if (!in_ram(addr, nbytes)) {
         std::ostringstream oss;
         oss << "Memory access out of range: addr=0x"
             << std::hex << addr << " nbytes=" << std::dec << nbytes
-            << " mem_size=" << mem_.size();
+            << " mem_base=0x" << std::hex << base_ << " mem_size=" << std::dec << size_;
         throw std::out_of_range(oss.str());
     }
 }
 
-void Memory::load_binary(const std::string& path, std::uint32_t base) {
+std::size_t Memory::load_binary(const std::string& path, std::uint32_t base) {
     std::ifstream file(path, std::ios::binary);
     if (!file) {
         throw std::runtime_error("Failed to open binary file: " + path);
@@ -33,31 +189,63 @@ void Memory::load_binary(const std::string& path, std::uint32_t base) {
         std::istreambuf_iterator<char>()
     );
 
-    check_addr(base, buf.size());
+    write_block(base, buf.data(), buf.size());
+    return buf.size();
+}
+
+void Memory::read_block(std::uint32_t addr, void* dst, std::size_t nbytes) const {
+    if (nbytes == 0) return;
+    check_addr(addr, nbytes);
+
+    auto* out = static_cast<std::uint8_t*>(dst);
+    while (nbytes > 0) {
+        const std::size_t off = addr & (kPageSize - 1);
+        const std::size_t n = std::min<std::size_t>(nbytes, kPageSize - off);
+        const std::uint8_t* p = read_page(addr, static_cast<std::uint32_t>(n));
+        if (p) std::memcpy(out, p + off, n);
+        else std::memset(out, 0, n);
+        out += n;
+        addr += static_cast<std::uint32_t>(n);
+        nbytes -= n;
+    }
+}
+
+void Memory::write_block(std::uint32_t addr, const void* src, std::size_t nbytes) {
+    if (nbytes == 0) return;
+    check_addr(addr, nbytes);
 
-    for (std::size_t i = 0; i < buf.size(); ++i) {
-        mem_[static_cast<std::size_t>(base) + i] = buf[i];
+    auto* in = static_cast<const std::uint8_t*>(src);
+    while (nbytes > 0) {
+        const std::size_t off = addr & (kPageSize - 1);
+        const std::size_t n = std::min<std::size_t>(nbytes, kPageSize - off);
+        std::memcpy(write_page(addr, static_cast<std::uint32_t>(n)) + off, in, n);
+        in += n;
+        addr += static_cast<std::uint32_t>(n);
+        nbytes -= n;
     }
 }
 
 std::uint8_t Memory::load8(std::uint32_t addr) const {
-    check_addr(addr, 1);
-    return mem_[static_cast<std::size_t>(addr)];
+    if (!in_ram(addr, 1)) return static_cast<std::uint8_t>(device_read(addr, 1));
+    const std::uint8_t* p = read_page(addr, 1);
+    return p ? p[addr & (kPageSize - 1)] : 0;
 }
 
 void Memory::store8(std::uint32_t addr, std::uint8_t value) {
-    check_addr(addr, 1);
-    mem_[static_cast<std::size_t>(addr)] = value;
+    if (!in_ram(addr, 1)) { device_write(addr, value, 1); return; }
+    write_page(addr, 1)[addr & (kPageSize - 1)] = value;
 }
 
 uint16_t Memory::load16(uint32_t addr) const {
     if ((addr & 0x1u) != 0) {
         throw std::runtime_error("Misaligned load16 at addr=" + std::to_string(addr));
     }
-    check_addr(addr, 2);
-    size_t a = static_cast<size_t>(addr);
-    uint16_t b0 = mem_[a + 0];
-    uint16_t b1 = mem_[a + 1];
+    if (!in_ram(addr, 2)) return static_cast<uint16_t>(device_read(addr, 2));
+    const uint8_t* p = read_page(addr, 2);
+    if (!p) return 0;
+    size_t a = addr & (kPageSize - 1);
+    uint16_t b0 = p[a + 0];
+    uint16_t b1 = p[a + 1];
     return (uint16_t)(b0 | (b1 << 8));
 }
 
@@ -65,10 +253,11 @@ void Memory::store16(uint32_t addr, uint16_t value) {
     if ((addr & 0x1u) != 0) {
         throw std::runtime_error("Misaligned store16 at addr=" + std::to_string(addr));
     }
-    check_addr(addr, 2);
-    size_t a = static_cast<size_t>(addr);
-    mem_[a + 0] = (uint8_t)(value & 0xFF);
-    mem_[a + 1] = (uint8_t)((value >> 8) & 0xFF);
+    if (!in_ram(addr, 2)) { device_write(addr, value, 2); return; }
+    uint8_t* p = write_page(addr, 2);
+    size_t a = addr & (kPageSize - 1);
+    p[a + 0] = (uint8_t)(value & 0xFF);
+    p[a + 1] = (uint8_t)((value >> 8) & 0xFF);
 }
 
 std::uint32_t Memory::load32(std::uint32_t addr) const {
@@ -76,13 +265,15 @@ std::uint32_t Memory::load32(std::uint32_t addr) const {
         throw std::runtime_error("Misaligned load32 at addr=0x" + std::to_string(addr));
     }
 
-    check_addr(addr, 4);
+    if (!in_ram(addr, 4)) return device_read(addr, 4);
 
-    const std::size_t a = static_cast<std::size_t>(addr);
-    std::uint32_t b0 = mem_[a + 0];
-    std::uint32_t b1 = mem_[a + 1];
-    std::uint32_t b2 = mem_[a + 2];
-    std::uint32_t b3 = mem_[a + 3];
+    const std::uint8_t* p = read_page(addr, 4);
+    if (!p) return 0;
+    const std::size_t a = addr & (kPageSize - 1);
+    std::uint32_t b0 = p[a + 0];
+    std::uint32_t b1 = p[a + 1];
+    std::uint32_t b2 = p[a + 2];
+    std::uint32_t b3 = p[a + 3];
 
     return (b0) | (b1 << 8) | (b2 << 16) | (b3 << 24);
 }
@@ -92,13 +283,14 @@ void Memory::store32(std::uint32_t addr, std::uint32_t value) {
         throw std::runtime_error("Misaligned store32 at addr=0x" + std::to_string(addr));
     }
 
-    check_addr(addr, 4);
+    if (!in_ram(addr, 4)) { device_write(addr, value, 4); return; }
 
-    const std::size_t a = static_cast<std::size_t>(addr);
-    mem_[a + 0] = static_cast<std::uint8_t>(value & 0xFF);
-    mem_[a + 1] = static_cast<std::uint8_t>((value >> 8) & 0xFF);
-    mem_[a + 2] = static_cast<std::uint8_t>((value >> 16) & 0xFF);
-    mem_[a + 3] = static_cast<std::uint8_t>((value >> 24) & 0xFF);
+    std::uint8_t* p = write_page(addr, 4);
+    const std::size_t a = addr & (kPageSize - 1);
+    p[a + 0] = static_cast<std::uint8_t>(value & 0xFF);
+    p[a + 1] = static_cast<std::uint8_t>((value >> 8) & 0xFF);
+    p[a + 2] = static_cast<std::uint8_t>((value >> 16) & 0xFF);
+    p[a + 3] = static_cast<std::uint8_t>((value >> 24) & 0xFF);
 }
 
-} // namespace rv
\ No newline at end of file
+} // namespace rv
\ No newline at end of file
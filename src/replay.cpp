@@ -0,0 +1,140 @@
+#include "rv/replay.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace rv {
+
+namespace {
+
+constexpr std::size_t kFlushBytes = 64 * 1024;
+
+const char* kind_name(int kind) {
+    switch (kind) {
+        case 1:  return "device read";
+        case 2:  return "syscall";
+        case 3:  return "data";
+        default: return "unknown entry";
+    }
+}
+
+} // namespace
+
+InputLog::InputLog(const std::string& path, Mode mode) : mode_(mode), path_(path) {
+    if (mode == Mode::Record) {
+        f_ = std::fopen(path.c_str(), "wb");
+        if (!f_) throw std::runtime_error("Cannot open replay log: " + path);
+        out_.reserve(kFlushBytes + 64);
+        out_.insert(out_.end(), kReplayLogMagic, kReplayLogMagic + sizeof(kReplayLogMagic));
+        return;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("Cannot open replay log: " + path);
+    in_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (in_.size() < sizeof(kReplayLogMagic) ||
+        std::memcmp(in_.data(), kReplayLogMagic, sizeof(kReplayLogMagic)) != 0) {
+        throw std::runtime_error("Not a replay log: " + path);
+    }
+    pos_ = sizeof(kReplayLogMagic);
+}
+
+InputLog::~InputLog() {
+    if (f_) {
+        flush();
+        std::fclose(f_);
+    }
+}
+
+void InputLog::flush() {
+    if (!f_ || out_.empty()) return;
+    std::fwrite(out_.data(), 1, out_.size(), f_);
+    std::fflush(f_);
+    out_.clear();
+}
+
+void InputLog::put(uint64_t v) {
+    while (v >= 0x80) {
+        out_.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out_.push_back((uint8_t)v);
+}
+
+uint64_t InputLog::get() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos_ == in_.size()) throw ReplayDivergence("replay log " + path_ + " is truncated");
+        const uint8_t b = in_[pos_++];
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    throw ReplayDivergence("replay log " + path_ + " is corrupt");
+}
+
+void InputLog::expect(Kind kind) {
+    if (pos_ == in_.size()) {
+        throw ReplayDivergence("replay: guest wants a " + std::string(kind_name((int)kind)) +
+                               " after the end of the log (" + std::to_string(entries_) + " entries)");
+    }
+    if (in_[pos_] != (uint8_t)kind) {
+        throw ReplayDivergence("replay: guest wants a " + std::string(kind_name((int)kind)) +
+                               " but entry " + std::to_string(entries_) + " is a " + kind_name(in_[pos_]));
+    }
+    pos_++;
+    entries_++;
+}
+
+uint32_t InputLog::value(Kind kind, uint32_t live) {
+    if (mode_ == Mode::Replay) {
+        expect(kind);
+        return (uint32_t)get();
+    }
+    out_.push_back((uint8_t)kind);
+    put(live);
+    entries_++;
+    if (out_.size() >= kFlushBytes) flush();
+    return live;
+}
+
+void InputLog::record_data(uint32_t addr, const void* data, std::size_t n) {
+    out_.push_back((uint8_t)Kind::Data);
+    put(addr);
+    put(n);
+    const auto* p = static_cast<const uint8_t*>(data);
+    out_.insert(out_.end(), p, p + n);
+    entries_++;
+    if (out_.size() >= kFlushBytes) flush();
+}
+
+void InputLog::record_syscall(uint32_t number, uint32_t ret) {
+    out_.push_back((uint8_t)Kind::Syscall);
+    put(number);
+    put(ret);
+    entries_++;
+    if (out_.size() >= kFlushBytes) flush();
+}
+
+bool InputLog::replay_data(uint32_t& addr, std::vector<uint8_t>& data) {
+    if (pos_ == in_.size() || in_[pos_] != (uint8_t)Kind::Data) return false;
+    expect(Kind::Data);
+    addr = (uint32_t)get();
+    const uint64_t n = get();
+    if (n > in_.size() - pos_) throw ReplayDivergence("replay log " + path_ + " is truncated");
+    data.assign(in_.begin() + (std::ptrdiff_t)pos_, in_.begin() + (std::ptrdiff_t)(pos_ + n));
+    pos_ += (std::size_t)n;
+    return true;
+}
+
+uint32_t InputLog::replay_syscall(uint32_t number) {
+    expect(Kind::Syscall);
+    const uint64_t logged = get();
+    if (logged != number) {
+        throw ReplayDivergence("replay: guest made syscall " + std::to_string(number) + " but entry " +
+                               std::to_string(entries_ - 1) + " is syscall " + std::to_string(logged));
+    }
+    return (uint32_t)get();
+}
+
+} // namespace rv
@@ -0,0 +1,151 @@
+#include "rv/scheduler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace rv {
+
+Machine::Machine(std::size_t mem_size, const Isa& isa) : mem(mem_size), cpu(mem) {
+    cpu.set_isa(isa);
+}
+
+void Machine::enable_syscalls(uint32_t heap_base) {
+    sys = std::make_unique<Syscalls>(mem);
+    sys->set_heap_base(heap_base);
+    sys->install(cpu);
+}
+
+Scheduler::Scheduler(const Options& opts) : opts_(opts) {
+    unsigned n = opts_.workers ? opts_.workers : std::max(1u, std::thread::hardware_concurrency());
+    if (opts_.quantum == 0) throw std::invalid_argument("scheduler quantum must be nonzero");
+
+    for (unsigned i = 0; i < n; i++) queues_.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < n; i++) threads_.emplace_back([this, i] { worker(i); });
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+void Scheduler::submit(std::unique_ptr<Machine> m) {
+    m->cpu.set_decode_cache_size(opts_.decode_cache_entries);
+    m->status = Machine::Status::Runnable;
+
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++outstanding_;
+    }
+
+    Queue& q = *queues_[next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size()];
+    {
+        std::lock_guard<std::mutex> lk(q.mu);
+        q.q.push_back(std::move(m));
+    }
+    publish_queued();
+}
+
+void Scheduler::publish_queued() {
+    // Under mu_, so a worker cannot see queued_ == 0 and then miss the
+    // notify before it blocks.
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        queued_.fetch_add(1, std::memory_order_release);
+    }
+    work_cv_.notify_one();
+}
+
+std::vector<std::unique_ptr<Machine>> Scheduler::wait() {
+    std::unique_lock<std::mutex> lk(mu_);
+    done_cv_.wait(lk, [this] { return outstanding_ == 0; });
+    return std::move(done_);
+}
+
+std::unique_ptr<Machine> Scheduler::take(std::size_t self) {
+    {
+        Queue& q = *queues_[self];
+        std::lock_guard<std::mutex> lk(q.mu);
+        if (!q.q.empty()) {
+            auto m = std::move(q.q.front());
+            q.q.pop_front();
+            return m;
+        }
+    }
+
+    // Steal from the back, where the machines least likely to be picked up
+    // soon by their owner sit.
+    for (std::size_t i = 1; i < queues_.size(); i++) {
+        Queue& q = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> lk(q.mu);
+        if (!q.q.empty()) {
+            auto m = std::move(q.q.back());
+            q.q.pop_back();
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return m;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::worker(std::size_t self) {
+    for (;;) {
+        std::unique_ptr<Machine> m = take(self);
+
+        if (!m) {
+            std::unique_lock<std::mutex> lk(mu_);
+            work_cv_.wait(lk, [this] { return stop_ || queued_.load(std::memory_order_acquire) > 0; });
+            if (stop_) return;
+            continue;
+        }
+
+        queued_.fetch_sub(1, std::memory_order_acq_rel);
+        run_slice(*m);
+
+        if (m->status == Machine::Status::Runnable) {
+            Queue& q = *queues_[self];
+            {
+                std::lock_guard<std::mutex> lk(q.mu);
+                q.q.push_back(std::move(m));
+            }
+            publish_queued(); // an idle worker may steal it
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lk(mu_);
+        done_.push_back(std::move(m));
+        if (--outstanding_ == 0) done_cv_.notify_all();
+    }
+}
+
+void Scheduler::run_slice(Machine& m) {
+    const uint64_t used = m.cpu.instret();
+    if (used >= m.budget) {
+        m.status = Machine::Status::Budget;
+        return;
+    }
+
+    try {
+        m.cpu.run(std::min(opts_.quantum, m.budget - used));
+    } catch (const GuestExit& e) {
+        m.status = Machine::Status::Exited;
+        m.exit_code = e.code();
+    } catch (const GuestStop& e) {
+        switch (e.reason()) {
+            case GuestStop::Reason::Ebreak: m.status = Machine::Status::Ebreak; break;
+            case GuestStop::Reason::Ecall:  m.status = Machine::Status::Ecall; break;
+        }
+    } catch (const std::exception& e) {
+        m.status = Machine::Status::Fault;
+        m.fault = e.what();
+    }
+
+    if (m.status == Machine::Status::Runnable && m.cpu.instret() >= m.budget) {
+        m.status = Machine::Status::Budget;
+    }
+}
+
+} // namespace rv
@@ -0,0 +1,115 @@
+#include "rv/stats.hpp"
+#include "rv/memory.hpp"
+
+namespace rv {
+
+namespace {
+
+enum class OpClass : uint8_t { Alu, MulDiv, Load, Store, Branch, Jump, Csr, System, Illegal };
+
+constexpr const char* kClassNames[] = {
+    "alu", "muldiv", "load", "store", "branch", "jump", "csr", "system", "illegal"
+};
+
+OpClass op_class(Op op) {
+    switch (op) {
+        case Op::Lb: case Op::Lh: case Op::Lw: case Op::Lbu: case Op::Lhu:
+            return OpClass::Load;
+        case Op::Sb: case Op::Sh: case Op::Sw:
+            return OpClass::Store;
+        case Op::Beq: case Op::Bne: case Op::Blt: case Op::Bge: case Op::Bltu: case Op::Bgeu:
+            return OpClass::Branch;
+        case Op::Jal: case Op::Jalr:
+            return OpClass::Jump;
+        case Op::Mul: case Op::Mulh: case Op::Mulhsu: case Op::Mulhu:
+        case Op::Div: case Op::Divu: case Op::Rem: case Op::Remu:
+            return OpClass::MulDiv;
+        case Op::Csrrw: case Op::Csrrs: case Op::Csrrc:
+        case Op::Csrrwi: case Op::Csrrsi: case Op::Csrrci:
+            return OpClass::Csr;
+        case Op::Fence: case Op::FenceI: case Op::Ecall: case Op::Ebreak:
+        case Op::Mret: case Op::Wfi: case Op::Breakpoint:
+            return OpClass::System;
+        case Op::Illegal: case Op::Count:
+            return OpClass::Illegal;
+        default:
+            return OpClass::Alu; // lui/auipc and the integer ALU ops
+    }
+}
+
+} // namespace
+
+uint64_t Stats::total() const {
+    uint64_t n = 0;
+    for (uint64_t c : retired) n += c;
+    return n;
+}
+
+uint64_t Stats::branches() const {
+    return count(Op::Beq) + count(Op::Bne) + count(Op::Blt) +
+           count(Op::Bge) + count(Op::Bltu) + count(Op::Bgeu);
+}
+
+uint64_t Stats::csr_accesses() const {
+    return count(Op::Csrrw) + count(Op::Csrrs) + count(Op::Csrrc) +
+           count(Op::Csrrwi) + count(Op::Csrrsi) + count(Op::Csrrci);
+}
+
+uint64_t Stats::loads(int width) const {
+    switch (width) {
+        case 1: return count(Op::Lb) + count(Op::Lbu);
+        case 2: return count(Op::Lh) + count(Op::Lhu);
+        case 4: return count(Op::Lw);
+        default: return 0;
+    }
+}
+
+uint64_t Stats::stores(int width) const {
+    switch (width) {
+        case 1: return count(Op::Sb);
+        case 2: return count(Op::Sh);
+        case 4: return count(Op::Sw);
+        default: return 0;
+    }
+}
+
+void write_stats_json(std::ostream& out, const Stats& s, const Memory& mem) {
+    out << "{\n";
+    out << "  \"instret\": " << s.total() << ",\n";
+
+    out << "  \"classes\": {";
+    uint64_t classes[sizeof(kClassNames) / sizeof(kClassNames[0])] = {};
+    for (std::size_t i = 0; i < s.retired.size(); i++) {
+        classes[(std::size_t)op_class((Op)i)] += s.retired[i];
+    }
+    for (std::size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        out << (i ? ", " : "") << "\"" << kClassNames[i] << "\": " << classes[i];
+    }
+    out << "},\n";
+
+    // Only mnemonics that actually retired.
+    out << "  \"ops\": {";
+    bool first = true;
+    for (std::size_t i = 0; i < s.retired.size(); i++) {
+        if (!s.retired[i]) continue;
+        out << (first ? "" : ", ") << "\"" << op_name((Op)i) << "\": " << s.retired[i];
+        first = false;
+    }
+    out << "},\n";
+
+    out << "  \"loads\": {\"1\": " << s.loads(1) << ", \"2\": " << s.loads(2)
+        << ", \"4\": " << s.loads(4) << "},\n";
+    out << "  \"stores\": {\"1\": " << s.stores(1) << ", \"2\": " << s.stores(2)
+        << ", \"4\": " << s.stores(4) << "},\n";
+    out << "  \"branches\": {\"taken\": " << s.branches_taken
+        << ", \"not_taken\": " << (s.branches() - s.branches_taken) << "},\n";
+    out << "  \"csr_accesses\": " << s.csr_accesses() << ",\n";
+    out << "  \"interrupts\": " << s.interrupts << ",\n";
+    out << "  \"exceptions\": " << s.exceptions << ",\n";
+    out << "  \"memory\": {\"page_size\": " << Memory::kPageSize
+        << ", \"pages_touched\": " << mem.pages_touched()
+        << ", \"resident_bytes\": " << mem.resident_bytes() << "}\n";
+    out << "}\n";
+}
+
+} // namespace rv
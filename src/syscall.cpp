@@ -0,0 +1,326 @@
+#include "rv/syscall.hpp"
+#include "rv/cpu.hpp"
+#include "rv/memory.hpp"
+#include "rv/replay.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace rv {
+
+namespace {
+
+// ABI register numbers
+constexpr int kSp = 2;
+constexpr int kA0 = 10;
+constexpr int kA1 = 11;
+constexpr int kA2 = 12;
+constexpr int kA3 = 13;
+constexpr int kA7 = 17;
+
+// Host buffer used to stage guest <-> host transfers.
+constexpr std::size_t kChunk = 64 * 1024;
+
+// newlib's <sys/_default_fcntl.h> flag values
+constexpr uint32_t kGuestAccMode = 0x0003;
+constexpr uint32_t kGuestAppend  = 0x0008;
+constexpr uint32_t kGuestCreat   = 0x0200;
+constexpr uint32_t kGuestTrunc   = 0x0400;
+constexpr uint32_t kGuestExcl    = 0x0800;
+
+// AT_FDCWD as passed by newlib
+constexpr int32_t kGuestAtFdcwd = -100;
+
+// Sizes of newlib's struct kernel_stat and struct timeval on rv32
+constexpr uint32_t kGuestStatSize = 128;
+constexpr uint32_t kGuestTimevalSize = 16;
+
+// argc, argv[0] = NULL, envp[0] = NULL and auxv's AT_NULL pair, padded to
+// keep sp 16-byte aligned as the psABI requires
+constexpr uint32_t kStartupBlock = 32;
+
+int host_open_flags(uint32_t guest) {
+    int f = 0;
+    switch (guest & kGuestAccMode) {
+        case 0: f = O_RDONLY; break;
+        case 1: f = O_WRONLY; break;
+        default: f = O_RDWR; break;
+    }
+    if (guest & kGuestAppend) f |= O_APPEND;
+    if (guest & kGuestCreat)  f |= O_CREAT;
+    if (guest & kGuestTrunc)  f |= O_TRUNC;
+    if (guest & kGuestExcl)   f |= O_EXCL;
+    return f;
+}
+
+void put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+void put64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+} // namespace
+
+Syscalls::Syscalls(Memory& mem) : mem_(mem), fds_{0, 1, 2} {}
+
+Syscalls::~Syscalls() {
+    for (std::size_t i = 3; i < fds_.size(); i++) {
+        if (fds_[i] >= 0) ::close(fds_[i]);
+    }
+}
+
+void Syscalls::install(CPU& cpu) {
+    cpu.set_ecall_handler([this](CPU& c) { handle(c); });
+}
+
+void Syscalls::init_stack(CPU& cpu) {
+    const uint32_t top = static_cast<uint32_t>((mem_.base() + mem_.size()) & ~std::size_t{15});
+    const uint32_t sp = top - kStartupBlock;
+    const uint8_t zeros[kStartupBlock] = {};
+    mem_.write_block(sp, zeros, sizeof(zeros));
+    cpu.set_reg(kSp, sp);
+}
+
+void Syscalls::handle(CPU& cpu) {
+    const uint32_t number = cpu.reg(kA7);
+    InputLog* log = mem_.input_log();
+    // brk and exit depend on guest state alone, so they are never logged.
+    const bool logged = log && number != kBrk && number != kExit && number != kExitGroup;
+
+    // A host read or write cannot be taken back, so a watched buffer stops
+    // the ECALL before either happens; the copies then ignore watchpoints.
+    check_watchpoints(cpu);
+
+    uint32_t ret;
+    if (logged && log->replaying()) ret = replay(cpu, *log);
+    else ret = dispatch(cpu);
+
+    if (logged && !log->replaying()) log->record_syscall(number, ret);
+    cpu.set_reg(kA0, ret);
+}
+
+uint32_t Syscalls::replay(CPU& cpu, InputLog& log) {
+    // Console output is still shown; nothing else reaches the host.
+    const uint32_t fd = cpu.reg(kA0);
+    if (cpu.reg(kA7) == kWrite && (fd == 1 || fd == 2) && host_fd(fd) >= 0) {
+        sys_write(fd, cpu.reg(kA1), cpu.reg(kA2));
+    }
+
+    uint32_t addr = 0;
+    std::vector<uint8_t> data;
+    SuspendWatchpoints guard(mem_);
+    while (log.replay_data(addr, data)) mem_.write_block(addr, data.data(), data.size());
+    return log.replay_syscall(cpu.reg(kA7));
+}
+
+uint32_t Syscalls::dispatch(CPU& cpu) {
+    const uint32_t a0 = cpu.reg(kA0);
+    const uint32_t a1 = cpu.reg(kA1);
+    const uint32_t a2 = cpu.reg(kA2);
+    uint32_t ret = 0;
+
+    switch (cpu.reg(kA7)) {
+        case kOpen:   ret = static_cast<uint32_t>(sys_open(a0, a1, a2)); break;
+        case kOpenat:
+            // Relative paths are resolved against the host cwd, as pk does.
+            if (static_cast<int32_t>(a0) != kGuestAtFdcwd) { ret = static_cast<uint32_t>(-EBADF); break; }
+            ret = static_cast<uint32_t>(sys_open(a1, a2, cpu.reg(kA3)));
+            break;
+        case kClose:  ret = static_cast<uint32_t>(sys_close(a0)); break;
+        case kLseek:  ret = static_cast<uint32_t>(sys_lseek(a0, static_cast<int32_t>(a1), a2)); break;
+        case kRead:   ret = static_cast<uint32_t>(sys_read(a0, a1, a2)); break;
+        case kWrite:  ret = static_cast<uint32_t>(sys_write(a0, a1, a2)); break;
+        case kFstat:  ret = static_cast<uint32_t>(sys_fstat(a0, a1)); break;
+        case kGettimeofday: ret = static_cast<uint32_t>(sys_gettimeofday(a0)); break;
+        case kBrk:    ret = sys_brk(a0); break;
+        case kExit:
+        case kExitGroup:
+            throw GuestExit(static_cast<int32_t>(a0));
+        default:
+            ret = static_cast<uint32_t>(-ENOSYS);
+            break;
+    }
+    return ret;
+}
+
+void Syscalls::check_watchpoints(const CPU& cpu) const {
+    const uint32_t a0 = cpu.reg(kA0);
+    const uint32_t a1 = cpu.reg(kA1);
+    const uint32_t a2 = cpu.reg(kA2);
+    // Out-of-RAM buffers fail with -EFAULT instead, so they are not checked.
+    auto check = [&](uint32_t addr, uint32_t n, uint8_t access) {
+        if (in_ram(addr, n)) mem_.check_watchpoints(addr, n, access);
+    };
+    switch (cpu.reg(kA7)) {
+        case kRead:         check(a1, a2, Memory::kWatchWrite); break;
+        case kWrite:        check(a1, a2, Memory::kWatchRead); break;
+        case kFstat:        check(a1, kGuestStatSize, Memory::kWatchWrite); break;
+        case kGettimeofday: check(a0, kGuestTimevalSize, Memory::kWatchWrite); break;
+        default: break; // open's path is read before the host is touched
+    }
+}
+
+void Syscalls::copy_out(uint32_t addr, const void* data, std::size_t n) {
+    SuspendWatchpoints guard(mem_);
+    mem_.write_block(addr, data, n);
+    if (InputLog* log = mem_.input_log()) log->record_data(addr, data, n);
+}
+
+bool Syscalls::in_ram(uint32_t addr, std::size_t nbytes) const {
+    return static_cast<std::size_t>(addr - mem_.base()) + nbytes <= mem_.size();
+}
+
+int Syscalls::host_fd(uint32_t fd) const {
+    if (fd >= fds_.size()) return -1;
+    return fds_[fd];
+}
+
+int32_t Syscalls::sys_open(uint32_t path_addr, uint32_t flags, uint32_t mode) {
+    // Copy a page at a time and look for the NUL in each chunk; the name,
+    // NUL included, must fit in 4096 bytes.
+    constexpr std::size_t kPathMax = 4096;
+    std::string path;
+    char chunk[Memory::kPageSize];
+    for (uint32_t a = path_addr;;) {
+        if (path.size() >= kPathMax) return -ENAMETOOLONG;
+        if (!in_ram(a, 1)) return -EFAULT;
+        std::size_t n = Memory::kPageSize - (a & (Memory::kPageSize - 1));
+        n = std::min(n, kPathMax - path.size());
+        n = std::min<std::size_t>(n, mem_.size() - (a - mem_.base()));
+        mem_.read_block(a, chunk, n);
+        if (const void* nul = std::memchr(chunk, 0, n)) {
+            path.append(chunk, static_cast<const char*>(nul) - chunk);
+            break;
+        }
+        path.append(chunk, n);
+        a += static_cast<uint32_t>(n);
+    }
+
+    int h = ::open(path.c_str(), host_open_flags(flags), static_cast<mode_t>(mode));
+    if (h < 0) return -errno;
+
+    auto slot = std::find(fds_.begin() + 3, fds_.end(), -1);
+    if (slot == fds_.end()) {
+        fds_.push_back(h);
+        return static_cast<int32_t>(fds_.size() - 1);
+    }
+    *slot = h;
+    return static_cast<int32_t>(slot - fds_.begin());
+}
+
+int32_t Syscalls::sys_close(uint32_t fd) {
+    int h = host_fd(fd);
+    if (h < 0) return -EBADF;
+    // Keep the host's stdio open even if the guest closes its copies.
+    if (fd > 2 && ::close(h) < 0) return -errno;
+    fds_[fd] = -1;
+    return 0;
+}
+
+int32_t Syscalls::sys_lseek(uint32_t fd, int32_t offset, uint32_t whence) {
+    int h = host_fd(fd);
+    if (h < 0) return -EBADF;
+    // SEEK_SET/CUR/END share values between newlib and the host.
+    off_t r = ::lseek(h, offset, static_cast<int>(whence));
+    if (r < 0) return -errno;
+    return static_cast<int32_t>(r);
+}
+
+int32_t Syscalls::sys_read(uint32_t fd, uint32_t buf, uint32_t count) {
+    int h = host_fd(fd);
+    if (h < 0) return -EBADF;
+    if (!in_ram(buf, count)) return -EFAULT;
+
+    std::vector<uint8_t> tmp(std::min<std::size_t>(count, kChunk));
+    uint32_t done = 0;
+    while (done < count) {
+        std::size_t want = std::min<std::size_t>(count - done, tmp.size());
+        ssize_t n = ::read(h, tmp.data(), want);
+        if (n < 0) return done ? static_cast<int32_t>(done) : -errno;
+        if (n == 0) break;
+        copy_out(buf + done, tmp.data(), static_cast<std::size_t>(n));
+        done += static_cast<uint32_t>(n);
+        if (static_cast<std::size_t>(n) < want) break; // short read: return what we have
+    }
+    return static_cast<int32_t>(done);
+}
+
+int32_t Syscalls::sys_write(uint32_t fd, uint32_t buf, uint32_t count) {
+    int h = host_fd(fd);
+    if (h < 0) return -EBADF;
+    if (!in_ram(buf, count)) return -EFAULT;
+
+    SuspendWatchpoints guard(mem_);
+    std::vector<uint8_t> tmp(std::min<std::size_t>(count, kChunk));
+    uint32_t done = 0;
+    while (done < count) {
+        std::size_t len = std::min<std::size_t>(count - done, tmp.size());
+        mem_.read_block(buf + done, tmp.data(), len);
+        ssize_t n = ::write(h, tmp.data(), len);
+        if (n < 0) return done ? static_cast<int32_t>(done) : -errno;
+        done += static_cast<uint32_t>(n);
+        if (static_cast<std::size_t>(n) < len) break;
+    }
+    return static_cast<int32_t>(done);
+}
+
+int32_t Syscalls::sys_fstat(uint32_t fd, uint32_t statbuf) {
+    int h = host_fd(fd);
+    if (h < 0) return -EBADF;
+
+    struct stat st {};
+    if (::fstat(h, &st) < 0) return -errno;
+
+    // struct kernel_stat as laid out by newlib for rv32 (128 bytes)
+    uint8_t ks[kGuestStatSize] = {};
+    put64(ks + 0,  static_cast<uint64_t>(st.st_dev));
+    put64(ks + 8,  static_cast<uint64_t>(st.st_ino));
+    put32(ks + 16, static_cast<uint32_t>(st.st_mode));
+    put32(ks + 20, static_cast<uint32_t>(st.st_nlink));
+    put32(ks + 24, static_cast<uint32_t>(st.st_uid));
+    put32(ks + 28, static_cast<uint32_t>(st.st_gid));
+    put64(ks + 32, static_cast<uint64_t>(st.st_rdev));
+    put64(ks + 48, static_cast<uint64_t>(st.st_size));
+    put32(ks + 56, static_cast<uint32_t>(st.st_blksize));
+    put64(ks + 64, static_cast<uint64_t>(st.st_blocks));
+    put64(ks + 72, static_cast<uint64_t>(st.st_atime));
+    put64(ks + 88, static_cast<uint64_t>(st.st_mtime));
+    put64(ks + 104, static_cast<uint64_t>(st.st_ctime));
+
+    if (!in_ram(statbuf, sizeof(ks))) return -EFAULT;
+    copy_out(statbuf, ks, sizeof(ks));
+    return 0;
+}
+
+int32_t Syscalls::sys_gettimeofday(uint32_t tv) {
+    struct timeval now {};
+    ::gettimeofday(&now, nullptr);
+
+    // struct timeval { int64_t tv_sec; int32_t tv_usec; } padded to 16 bytes
+    uint8_t out[kGuestTimevalSize] = {};
+    put64(out + 0, static_cast<uint64_t>(now.tv_sec));
+    put32(out + 8, static_cast<uint32_t>(now.tv_usec));
+
+    if (!in_ram(tv, sizeof(out))) return -EFAULT;
+    copy_out(tv, out, sizeof(out));
+    return 0;
+}
+
+uint32_t Syscalls::sys_brk(uint32_t addr) {
+    // Like Linux: return the new break on success, the old one on failure.
+    if (addr >= heap_base_ && static_cast<std::size_t>(addr - mem_.base()) <= mem_.size()) {
+        brk_ = addr;
+    }
+    return brk_;
+}
+
+} // namespace rv
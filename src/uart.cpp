@@ -0,0 +1,47 @@
+#include "rv/uart.hpp"
+
+namespace rv {
+
+Uart::Uart(std::ostream& out, std::size_t flush_threshold)
+    : out_(out), flush_threshold_(flush_threshold) {
+    tx_.reserve(flush_threshold_);
+}
+
+Uart::~Uart() {
+    flush();
+}
+
+uint32_t Uart::read(uint32_t offset, int /*size*/) {
+    switch (offset) {
+        case kRegData: {
+            if (rx_.empty()) return 0;
+            uint8_t b = rx_.front();
+            rx_.pop_front();
+            return b;
+        }
+        case kRegLsr:
+            return kLsrThrEmpty | kLsrTxIdle | (rx_.empty() ? 0u : kLsrDataReady);
+        default:
+            return 0;
+    }
+}
+
+void Uart::write(uint32_t offset, uint32_t value, int /*size*/) {
+    if (offset != kRegData) return; // other registers are accepted and ignored
+
+    tx_.push_back(static_cast<char>(value & 0xFF));
+    if (tx_.size() >= flush_threshold_) flush();
+}
+
+void Uart::push_input(const std::string& bytes) {
+    rx_.insert(rx_.end(), bytes.begin(), bytes.end());
+}
+
+void Uart::flush() {
+    if (tx_.empty()) return;
+    out_.write(tx_.data(), static_cast<std::streamsize>(tx_.size()));
+    out_.flush();
+    tx_.clear();
+}
+
+} // namespace rv
@@ -0,0 +1,94 @@
+// Runs one riscv-tests ELF (rv32ui-p-add, rv32mi-p-csr, ...) and checks the
+// value the test environment writes to `tohost`: 1 is a pass, anything else
+// is (failing test number << 1) | 1. CMake registers one CTest case per ELF
+// when RISCV_TESTS_DIR is set.
+//
+// The instruction count and run time are printed as CTest measurements, so
+// they end up in the dashboard next to the pass/fail result.
+#include "rv/cpu.hpp"
+#include "rv/debug.hpp"
+#include "rv/elf.hpp"
+#include "rv/isa.hpp"
+#include "rv/memory.hpp"
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// riscv-tests link at 0x80000000 and stay well inside a few pages.
+constexpr uint32_t kRamBase = 0x80000000u;
+constexpr std::size_t kRamSize = 1u << 20;
+
+void measurement(const char* name, double value) {
+    std::cout << "<DartMeasurement name=\"" << name << "\" type=\"numeric/double\">"
+              << value << "</DartMeasurement>\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string isa = "rv32i";
+    uint64_t max_instructions = 10'000'000;
+    std::string elf_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--isa" && i + 1 < argc) isa = argv[++i];
+        else if (a == "--max-instructions" && i + 1 < argc) max_instructions = std::stoull(argv[++i], nullptr, 0);
+        else elf_path = a;
+    }
+    if (elf_path.empty()) {
+        std::cerr << "Usage: rv32i_riscv_tests [--isa rv32im] [--max-instructions N] <test.elf>\n";
+        return 2;
+    }
+
+    rv::Memory mem(kRamSize, kRamBase);
+    rv::CPU cpu(mem);
+    uint32_t tohost = 0;
+    try {
+        const rv::ElfImage img = rv::load_elf(mem, elf_path);
+        auto sym = img.symbol("tohost");
+        if (!sym) throw std::runtime_error("no tohost symbol in " + elf_path);
+        tohost = *sym;
+        cpu.set_isa(rv::parse_isa(isa));
+        cpu.reset(img.entry);
+        cpu.set_trap_exceptions(true);
+        // The test ends with a store to tohost; the watchpoint stops right
+        // before it, so the rest of the run pays nothing.
+        mem.add_watchpoint(tohost, 4, rv::Memory::kWatchWrite);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 2;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::string stop;
+    uint32_t result = 0;
+    try {
+        cpu.run(max_instructions);
+        stop = "instruction limit reached";
+    } catch (const rv::DebugStop&) {
+        cpu.step(); // the store itself
+        result = mem.load32(tohost);
+    } catch (const std::exception& e) {
+        stop = e.what();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    measurement("instret", (double)cpu.instret());
+    measurement("seconds", seconds);
+
+    if (result == 1) {
+        std::cout << "PASS " << elf_path << " (" << cpu.instret() << " instructions)\n";
+        return 0;
+    }
+    if (result != 0) {
+        std::cout << "FAIL " << elf_path << ": test " << (result >> 1) << " failed\n";
+    } else {
+        std::cout << "FAIL " << elf_path << ": " << stop << " at pc=0x" << std::hex << cpu.pc() << std::dec << "\n";
+    }
+    return 1;
+}